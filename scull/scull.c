@@ -5,94 +5,304 @@
 #include<linux/cdev.h>
 #include<linux/slab.h>
 #include<linux/uaccess.h>
-#include<linux/semaphore.h>
-
-#define SCULL_QUANTUM 40
+#include<linux/rwsem.h>
+#include<linux/xarray.h>
+#include<linux/mm.h>
+#include<linux/uio.h>
+#include<linux/math64.h>
+#include<linux/pipe_fs_i.h>
+#include<linux/splice.h>
+#include<linux/proc_fs.h>
+#include<linux/seq_file.h>
+
+#ifndef SCULL_QUANTUM
+#define SCULL_QUANTUM 40        /* 2^n 페이지 크기로 정의하면 mmap 가능 */
+#endif
+
+#ifndef SCULL_QSET
 #define SCULL_QSET    10
+#endif
+
+#ifndef SCULL_ORDER
+#define SCULL_ORDER   -1        /* 0 이상이면 페이지 모드 */
+#endif
+
+#define SCULL_ORDER_MAX 10
+/*
+ * 페이지 모드 item 크기 (PAGE_SIZE << order) * (PAGE_SIZE / sizeof(void *))가 int인 itemsize에
+ * 들어가는 최대 order, 64비트 4K 페이지에서 9, 64K 페이지에서 1
+ */
+#define SCULL_ORDER_LIMIT min(SCULL_ORDER_MAX, 30 - 2 * PAGE_SHIFT + ilog2(sizeof(void *)))
+
+#ifndef SCULL_POOL_SIZE
+#define SCULL_POOL_SIZE 0       /* 적재 시 장치별로 미리 확보할 quantum 수 */
+#endif
+
+#ifndef SCULL_POOL_MAX
+#define SCULL_POOL_MAX  64      /* 장치별 풀에 모아둘 수 있는 최대 quantum 수 */
+#endif
+
 #define DEVICE_NAME   "scull_"
 
 int scull_major;
 int scull_minor;
 int scull_nr_devs = 1;
+int scull_order = SCULL_ORDER;
+int scull_pool_size = SCULL_POOL_SIZE;
+int scull_pool_max = SCULL_POOL_MAX;
+
+module_param(scull_order, int, S_IRUGO);
+module_param(scull_pool_size, int, S_IRUGO);
+module_param(scull_pool_max, int, S_IRUGO);
 
 struct scull_qset{
     void **data;
-    struct scull_qset* next;
+};
+
+/* 장치별 quantum 풀 */
+struct scull_pool{
+    void *free;             /* 비어 있는 quantum의 free list */
+    int count;
+    unsigned long hits, misses;
 };
 
 struct scull_dev{
-    struct scull_qset *data;
+    struct xarray qsets;    /* item 번호 -> struct scull_qset */
     int quantum;
     int qset;
+    int order;              /* quantum 페이지 order, -1이면 kmalloc */
     unsigned long size;
-    struct semaphore sem;
+    atomic_t vmas;          /* 장치를 매핑하고 있는 vma 수 */
+    struct scull_pool pool;
+    struct rw_semaphore sem;    /* read는 공유, write/trim/할당은 배타 */
     struct cdev cdev;
 };
 
 struct scull_dev *scull_device;
-struct scull_qset *scull_follow(struct scull_dev *dev, int n)
-{
-    struct scull_qset *qs = dev->data;
-    if(!qs){
-        qs = dev->data = kmalloc(sizeof(struct scull_qset), GFP_KERNEL);
-        if(qs == NULL){
-            printk(KERN_ERR "in scull_follow, qs : NULL\n");
-            return NULL;
-        }
-        memset(qs, 0, sizeof(struct scull_qset));
-    }
+/* 모듈 전용 slab 캐시 */
+struct kmem_cache *scull_qset_cache;      /* struct scull_qset */
+struct kmem_cache *scull_data_cache;      /* qset 포인터 배열 */
+struct kmem_cache *scull_quantum_cache;   /* byte 모드 quantum */
+
+/*
+ * item 번호로 qset을 찾는다. 찾기만 하고 할당하지 않으므로 read 경로에서 사용
+ * xarray 조회는 장치 크기와 무관하게 O(log n)
+ */
+struct scull_qset *scull_follow(struct scull_dev *dev, unsigned long n)
+{
+    return xa_load(&dev->qsets, n);
+}
 
-    while(n--){
-        if(!qs->next){
-            qs->next = kmalloc(sizeof(struct scull_qset), GFP_KERNEL);
-            if(qs->next == NULL){
-                printk(KERN_ERR "in scull_follow, qs->next : NULL\n");
-                return NULL;
-            }
-            memset(qs->next, 0, sizeof(struct scull_qset));
-        }
+/* write 경로용: item 번호의 qset이 없으면 새로 만들어 xarray에 등록 */
+struct scull_qset *scull_follow_create(struct scull_dev *dev, unsigned long n)
+{
+    struct scull_qset *qs = xa_load(&dev->qsets, n);
+    if(qs)
+        return qs;
+
+    qs = kmem_cache_zalloc(scull_qset_cache, GFP_KERNEL);
+    if(qs == NULL){
+        printk(KERN_ERR "in scull_follow_create, qs : NULL\n");
+        return NULL;
+    }
 
-        qs = qs->next;
-        continue;
+    if(xa_err(xa_store(&dev->qsets, n, qs, GFP_KERNEL))){
+        printk(KERN_ERR "in scull_follow_create, xa_store failed\n");
+        kmem_cache_free(scull_qset_cache, qs);
+        return NULL;
     }
     return qs;
 }
 
+/*
+ * 장치의 quantum, qset 크기를 정한다
+ * scull_order >= 0: quantum은 2^order 페이지, qset 포인터 배열은 정확히 한 페이지
+ * scull_order < 0 : 기존 byte 단위 quantum, 2의 거듭제곱 페이지 크기이면 페이지 할당자 사용
+ */
+void scull_set_geometry(struct scull_dev *dev)
+{
+    if(scull_order >= 0){
+        dev->order = scull_order;
+        dev->quantum = PAGE_SIZE << scull_order;
+        dev->qset = PAGE_SIZE / sizeof(void *);
+        return;
+    }
+
+    dev->quantum = SCULL_QUANTUM;
+    dev->qset = SCULL_QSET;
+    dev->order = -1;
+    if(dev->quantum >= PAGE_SIZE && dev->quantum == PAGE_SIZE << get_order(dev->quantum))
+        dev->order = get_order(dev->quantum);
+}
+
+/* qset 포인터 배열: 적재 시점의 qset 크기와 같으면 전용 캐시 사용 */
+void **scull_alloc_qset_data(struct scull_dev *dev)
+{
+    size_t size = dev->qset * sizeof(void *);
+
+    if(scull_data_cache && size == kmem_cache_size(scull_data_cache))
+        return kmem_cache_zalloc(scull_data_cache, GFP_KERNEL);
+    return kzalloc(size, GFP_KERNEL);
+}
+
+void scull_free_qset_data(struct scull_dev *dev, void **data)
+{
+    size_t size = dev->qset * sizeof(void *);
+
+    if(scull_data_cache && size == kmem_cache_size(scull_data_cache))
+        kmem_cache_free(scull_data_cache, data);
+    else
+        kfree(data);
+}
+
+/*
+ * 풀을 거치지 않고 quantum을 새로 할당, 해제, 새 quantum은 항상 0으로 채워짐
+ * 페이지 모드(order >= 0)이면 페이지 할당자에서 받아온다.
+ * 이렇게 받은 quantum만 mmap으로 사용자 공간에 그대로 매핑할 수 있음
+ */
+static void *__scull_alloc_quantum(int quantum, int order)
+{
+    if(order >= 0)
+        return (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO | __GFP_COMP, order);
+    if(scull_quantum_cache && quantum == kmem_cache_size(scull_quantum_cache))
+        return kmem_cache_zalloc(scull_quantum_cache, GFP_KERNEL);
+    return kzalloc(quantum, GFP_KERNEL);
+}
+
+static void __scull_free_quantum(void *q, int quantum, int order)
+{
+    if(order >= 0)
+        free_pages((unsigned long)q, order);
+    else if(scull_quantum_cache && quantum == kmem_cache_size(scull_quantum_cache))
+        kmem_cache_free(scull_quantum_cache, q);
+    else
+        kfree(q);
+}
+
+/*
+ * quantum 풀
+ * 해제된 quantum은 버리지 않고 장치별 free list에 모아두었다가 다시 사용한다.
+ * free list의 next 포인터는 비어 있는 quantum의 앞부분에 저장. dev->sem write 락을 잡고 호출
+ */
+void *scull_alloc_quantum(struct scull_dev *dev)
+{
+    struct scull_pool *pool = &dev->pool;
+    void *q = pool->free;
+
+    if(!q){
+        pool->misses++;
+        return __scull_alloc_quantum(dev->quantum, dev->order);
+    }
+
+    pool->free = *(void **)q;
+    pool->count--;
+    pool->hits++;
+    /* 쓰지 않은 부분은 0으로 읽혀야 하므로 이전 내용을 지움 */
+    memset(q, 0, dev->quantum);
+    return q;
+}
+
+void scull_free_quantum(struct scull_dev *dev, void *q)
+{
+    struct scull_pool *pool = &dev->pool;
+
+    if(!q)
+        return;
+
+    /* 다른 곳에서 아직 참조 중인 페이지는 재사용하지 않음 */
+    if(pool->count < scull_pool_max && dev->quantum >= sizeof(void *) &&
+       (dev->order < 0 || page_count(virt_to_page(q)) == 1)){
+        *(void **)q = pool->free;
+        pool->free = q;
+        pool->count++;
+        return;
+    }
+    __scull_free_quantum(q, dev->quantum, dev->order);
+}
+
+/* 풀에 담긴 quantum을 모두 시스템에 돌려줌, quantum, order는 풀에 담길 때의 크기 */
+void scull_pool_drain(struct scull_dev *dev, int quantum, int order)
+{
+    struct scull_pool *pool = &dev->pool;
+    void *q;
+
+    while((q = pool->free)){
+        pool->free = *(void **)q;
+        __scull_free_quantum(q, quantum, order);
+    }
+    pool->count = 0;
+}
+
+/* 풀에 quantum을 n개까지 미리 채워둠 */
+int scull_pool_fill(struct scull_dev *dev, int n)
+{
+    struct scull_pool *pool = &dev->pool;
+    void *q;
+
+    if(dev->quantum < sizeof(void *))
+        return 0;
+
+    while(pool->count < n){
+        q = __scull_alloc_quantum(dev->quantum, dev->order);
+        if(!q)
+            return -ENOMEM;
+        *(void **)q = pool->free;
+        pool->free = q;
+        pool->count++;
+    }
+    return 0;
+}
+
 int scull_trim(struct scull_dev *dev)
 {
-    struct scull_qset *next, *dptr;
+    struct scull_qset *dptr;
+    unsigned long item;
     int qset = dev->qset;
+    int quantum = dev->quantum, order = dev->order;
     int i;
 
-    for(dptr = dev->data; dptr; dptr = next){
+    /* 사용자 공간에 매핑된 페이지가 있으면 비우지 않음 */
+    if(atomic_read(&dev->vmas))
+        return -EBUSY;
+
+    /* quantum은 시스템에 돌려주지 않고 풀로 회수 */
+    xa_for_each(&dev->qsets, item, dptr){
         if(dptr->data){
             for(i = 0; i < qset; i++)
-                kfree(dptr->data[i]);
-            kfree(dptr->data);
+                scull_free_quantum(dev, dptr->data[i]);
+            scull_free_qset_data(dev, dptr->data);
             dptr->data = NULL;
         }
-
-        next = dptr->next;
-        kfree(dptr);
+        kmem_cache_free(scull_qset_cache, dptr);
     }
+    xa_destroy(&dev->qsets);
 
     dev->size = 0;
-    dev->quantum = SCULL_QUANTUM;
-    dev->qset = SCULL_QSET;
-    dev->data = NULL;
+    scull_set_geometry(dev);
+
+    /* 크기가 바뀌었으면 풀에 있던 quantum은 더 이상 쓸 수 없으므로 새 크기로 다시 채움 */
+    if(dev->quantum != quantum || dev->order != order){
+        scull_pool_drain(dev, quantum, order);
+        scull_pool_fill(dev, scull_pool_size);
+    }
     return 0;
 }
 
 int scull_open(struct inode *inode, struct file *filp)
 {
     struct scull_dev *dev;
+    int retval = 0;
     dev = container_of(inode->i_cdev, struct scull_dev, cdev);
 	filp->private_data = dev;
+    filp->f_mode |= FMODE_NOWAIT;
     if((filp->f_flags & O_ACCMODE) == O_WRONLY){
-        scull_trim(dev);
+        if(down_write_killable(&dev->sem))
+            return -ERESTARTSYS;
+        retval = scull_trim(dev);
+        up_write(&dev->sem);
     }
 
-    return 0;
+    return retval;
 }
 
 int scull_release(struct inode *inode, struct file *filp)
@@ -100,108 +310,522 @@ int scull_release(struct inode *inode, struct file *filp)
     return 0;
 }
 
-ssize_t scull_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+/*
+ * SEEK_DATA, SEEK_HOLE 도우미, dev->sem read 락을 잡고 호출
+ * 데이터/구멍의 단위는 quantum, 장치 끝은 항상 구멍으로 취급
+ */
+static loff_t scull_seek_data(struct scull_dev *dev, loff_t off)
 {
-    struct scull_dev *dev = filp->private_data;
     struct scull_qset *dptr;
     int quantum = dev->quantum, qset = dev->qset;
     int itemsize = quantum * qset;
-    int item, s_pos, q_pos, rest;
+    unsigned long item;
+    loff_t pos = off, start;
+    int s_pos;
+
+    if (off < 0 || off >= dev->size)
+        return -ENXIO;
+
+    while (pos < dev->size) {
+        /* 할당된 다음 qset까지는 xarray에서 바로 건너뜀 */
+        item = div_s64(pos, itemsize);
+        dptr = xa_find(&dev->qsets, &item, ULONG_MAX, XA_PRESENT);
+        if (!dptr)
+            break;
+        start = (loff_t)item * itemsize;
+        if (pos < start)
+            pos = start;
+
+        if (dptr->data) {
+            for (s_pos = (int)(pos - start) / quantum; s_pos < qset; s_pos++) {
+                if (dptr->data[s_pos]) {
+                    pos = max(pos, start + (loff_t)s_pos * quantum);
+                    return pos < dev->size ? pos : -ENXIO;
+                }
+            }
+        }
+        pos = start + itemsize;
+    }
+    return -ENXIO;
+}
+
+static loff_t scull_seek_hole(struct scull_dev *dev, loff_t off)
+{
+    struct scull_qset *dptr;
+    int quantum = dev->quantum, qset = dev->qset;
+    int itemsize = quantum * qset;
+    unsigned long item;
+    loff_t pos = off;
+    int s_pos, rest;
+
+    if (off < 0 || off >= dev->size)
+        return -ENXIO;
+
+    while (pos < dev->size) {
+        item = div_s64_rem(pos, itemsize, &rest);
+        s_pos = rest / quantum;
+
+        dptr = scull_follow(dev, item);
+        if (!dptr || !dptr->data || !dptr->data[s_pos])
+            return pos;
+        pos = (loff_t)item * itemsize + (loff_t)(s_pos + 1) * quantum;
+    }
+    return dev->size;
+}
+
+loff_t scull_llseek(struct file *filp, loff_t off, int whence)
+{
+    struct scull_dev *dev = filp->private_data;
+    loff_t newpos;
+
+    if (down_read_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+
+    switch (whence) {
+        case SEEK_SET:
+            newpos = off;
+            break;
+
+        case SEEK_CUR:
+            newpos = filp->f_pos + off;
+            break;
+
+        case SEEK_END:
+            newpos = dev->size + off;
+            break;
+
+        case SEEK_DATA:
+            newpos = scull_seek_data(dev, off);
+            break;
+
+        case SEEK_HOLE:
+            newpos = scull_seek_hole(dev, off);
+            break;
+
+        default:
+            newpos = -EINVAL;
+    }
+    up_read(&dev->sem);
+
+    if (newpos < 0)
+        return (whence == SEEK_DATA || whence == SEEK_HOLE) ? newpos : -EINVAL;
+    filp->f_pos = newpos;
+    return newpos;
+}
+
+/*
+ * 사용자 버퍼가 이 장치를 mmap한 영역이면 복사 중 난 fault가 scull_vma_fault에서
+ * dev->sem을 다시 잡으므로, 복사는 pagefault_disable 상태에서 하고
+ * 덜 복사되면 락을 놓고 버퍼를 fault-in 한 뒤 다시 잡고 이어서 복사한다
+ */
+ssize_t scull_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct scull_dev *dev = iocb->ki_filp->private_data;
+    struct scull_qset *dptr;
+    int nowait = iocb->ki_flags & IOCB_NOWAIT;
+    int quantum, qset, itemsize;
+    unsigned long item, cur_item;
+    int s_pos, q_pos, rest;
+    size_t done = 0, chunk, copied;
     ssize_t retval = 0;
 
-    if (down_interruptible(&dev->sem))
+    /* reader끼리는 서로 막지 않음, IOCB_NOWAIT이면 writer를 기다리지 않음 */
+    if (nowait) {
+        if (!down_read_trylock(&dev->sem))
+            return -EAGAIN;
+    } else if (down_read_interruptible(&dev->sem)) {
         return -ERESTARTSYS;
+    }
 
-    if (*f_pos >= dev->size)
-        goto out;
-    if (*f_pos + count > dev->size)
-        count = dev->size - *f_pos;
+relock:
+    /* 락을 놓은 사이 trim으로 geometry가 바뀌었을 수 있음 */
+    quantum = dev->quantum;
+    qset = dev->qset;
+    itemsize = quantum * qset;
+    cur_item = ULONG_MAX;
+    dptr = NULL;
+
+    /* 락을 한 번만 잡고 quantum, qset 경계를 넘어가며 요청 전체를 복사 */
+    while (iov_iter_count(to) && iocb->ki_pos < dev->size) {
+        item = (long)iocb->ki_pos / itemsize;
+        rest = (long)iocb->ki_pos % itemsize;
+        s_pos = rest / quantum;
+        q_pos = rest % quantum;
+
+        if (item != cur_item) {
+            dptr = scull_follow(dev, item);
+            cur_item = item;
+        }
 
-    item = (long)*f_pos / itemsize;
-    rest = (long)*f_pos % itemsize;
-    s_pos = rest / quantum;
-    q_pos = rest % quantum;
+        chunk = min(iov_iter_count(to), (size_t)(dev->size - iocb->ki_pos));
+
+        /* 할당되지 않은 구멍은 할당 없이 0으로 읽힘, qset 전체가 비었으면 item 끝까지 한 번에 */
+        pagefault_disable();
+        if (!dptr || !dptr->data) {
+            chunk = min(chunk, (size_t)(itemsize - rest));
+            copied = iov_iter_zero(chunk, to);
+        } else if (!dptr->data[s_pos]) {
+            chunk = min(chunk, (size_t)(quantum - q_pos));
+            copied = iov_iter_zero(chunk, to);
+        } else {
+            chunk = min(chunk, (size_t)(quantum - q_pos));
+            copied = copy_to_iter(dptr->data[s_pos] + q_pos, chunk, to);
+        }
+        pagefault_enable();
+        iocb->ki_pos += copied;
+        done += copied;
+        if (copied == chunk)
+            continue;
+
+        up_read(&dev->sem);
+        if (nowait) {
+            retval = -EAGAIN;
+            goto out_unlocked;
+        }
+        if (fault_in_iov_iter_writeable(to, chunk - copied) == chunk - copied) {
+            retval = -EFAULT;
+            goto out_unlocked;
+        }
+        if (down_read_interruptible(&dev->sem)) {
+            retval = -ERESTARTSYS;
+            goto out_unlocked;
+        }
+        goto relock;
+    }
+    up_read(&dev->sem);
 
-    dptr = scull_follow(dev, item);
-    if (!dptr || !dptr->data || !dptr->data[s_pos])
-        goto out;
+out_unlocked:
+    return done ? done : retval;
+}
 
-    if (count > quantum - q_pos)
-        count = quantum - q_pos;
+ssize_t scull_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct scull_dev *dev = iocb->ki_filp->private_data;
+    struct scull_qset *dptr;
+    int nowait = iocb->ki_flags & IOCB_NOWAIT;
+    int quantum, qset, itemsize;
+    unsigned long item, cur_item;
+    int s_pos, q_pos, rest;
+    size_t done = 0, chunk, copied;
+    ssize_t retval = -ENOMEM;
 
-    if (copy_to_user(buf, dptr->data[s_pos] + q_pos, count)) {
-        retval = -EFAULT;
-        goto out;
+    if (nowait) {
+        if (!down_write_trylock(&dev->sem))
+            return -EAGAIN;
+    } else if (down_write_killable(&dev->sem)) {
+        return -ERESTARTSYS;
     }
-    *f_pos += count;
-    retval = count;
 
-out:
-    up(&dev->sem);
-    return retval;
+relock:
+    quantum = dev->quantum;
+    qset = dev->qset;
+    itemsize = quantum * qset;
+    cur_item = ULONG_MAX;
+    dptr = NULL;
+
+    while (iov_iter_count(from)) {
+        item = (long)iocb->ki_pos / itemsize;
+        rest = (long)iocb->ki_pos % itemsize;
+        s_pos = rest / quantum;
+        q_pos = rest % quantum;
+
+        if (item != cur_item) {
+            dptr = scull_follow(dev, item);
+            /* IOCB_NOWAIT에서는 메모리 할당으로 잠들 수 있는 경우 중단 */
+            if (!dptr && nowait) {
+                retval = -EAGAIN;
+                break;
+            }
+            if (!dptr)
+                dptr = scull_follow_create(dev, item);
+            if (!dptr)
+                break;
+            cur_item = item;
+        }
+
+        if (nowait && (!dptr->data || !dptr->data[s_pos])) {
+            retval = -EAGAIN;
+            break;
+        }
+
+        if (!dptr->data) {
+            dptr->data = scull_alloc_qset_data(dev);
+            if (!dptr->data)
+                break;
+        }
+
+        if (!dptr->data[s_pos]) {
+            dptr->data[s_pos] = scull_alloc_quantum(dev);
+            if (!dptr->data[s_pos])
+                break;
+        }
+
+        chunk = min(iov_iter_count(from), (size_t)(quantum - q_pos));
+        pagefault_disable();
+        copied = copy_from_iter(dptr->data[s_pos] + q_pos, chunk, from);
+        pagefault_enable();
+        iocb->ki_pos += copied;
+        done += copied;
+        /* 락을 놓기 전에 쓴 만큼 장치 크기를 반영 */
+        if (dev->size < iocb->ki_pos)
+            dev->size = iocb->ki_pos;
+        if (copied == chunk)
+            continue;
+
+        up_write(&dev->sem);
+        if (nowait) {
+            retval = -EAGAIN;
+            goto out_unlocked;
+        }
+        if (fault_in_iov_iter_readable(from, chunk - copied) == chunk - copied) {
+            retval = -EFAULT;
+            goto out_unlocked;
+        }
+        if (down_write_killable(&dev->sem)) {
+            retval = -ERESTARTSYS;
+            goto out_unlocked;
+        }
+        goto relock;
+    }
+    up_write(&dev->sem);
+
+out_unlocked:
+    /* 일부라도 썼다면 쓴 만큼 반환 */
+    return done ? done : retval;
 }
 
-ssize_t scull_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
+/*
+ * splice_read (sendfile 포함)
+ * 페이지 모드에서는 quantum 페이지의 참조를 파이프 버퍼에 그대로 넘겨 복사를 생략한다.
+ * 구멍은 ZERO_PAGE를 넘기고, byte 모드는 페이지 단위가 아니므로 copy_splice_read로 복사
+ */
+static const struct pipe_buf_operations scull_pipe_buf_ops = {
+    .release = generic_pipe_buf_release,
+    .get     = generic_pipe_buf_get,
+};
+
+ssize_t scull_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe,
+                          size_t len, unsigned int flags)
 {
-    struct scull_dev *dev = filp->private_data;
+    struct scull_dev *dev = in->private_data;
     struct scull_qset *dptr;
+    struct pipe_buffer buf;
     int quantum = dev->quantum, qset = dev->qset;
     int itemsize = quantum * qset;
-    int item, s_pos, q_pos, rest;
-    ssize_t retval = -ENOMEM;
+    unsigned long item;
+    int s_pos, q_pos, rest;
+    size_t done = 0, chunk;
+    ssize_t retval = 0;
+    void *q;
+
+    if (dev->order < 0)
+        return copy_splice_read(in, ppos, pipe, len, flags);
 
-    if (down_interruptible(&dev->sem))
+    if (down_read_interruptible(&dev->sem))
         return -ERESTARTSYS;
 
-    item = (long)*f_pos / itemsize;
-    rest = (long)*f_pos % itemsize;
+    if (*ppos >= dev->size)
+        goto out;
+    if (*ppos + len > dev->size)
+        len = dev->size - *ppos;
+
+    while (done < len) {
+        item = (long)*ppos / itemsize;
+        rest = (long)*ppos % itemsize;
+        s_pos = rest / quantum;
+        q_pos = rest % quantum;
+
+        q = NULL;
+        dptr = scull_follow(dev, item);
+        if (dptr && dptr->data)
+            q = dptr->data[s_pos];
+
+        buf.page = q ? virt_to_page(q + q_pos) : ZERO_PAGE(0);
+        buf.offset = q_pos & ~PAGE_MASK;
+        chunk = min(len - done, (size_t)(PAGE_SIZE - buf.offset));
+        buf.len = chunk;
+        buf.ops = &scull_pipe_buf_ops;
+        buf.flags = 0;
+        buf.private = 0;
+        get_page(buf.page);
+
+        /* 파이프가 가득 차면 add_to_pipe가 참조를 돌려주고 -EAGAIN 반환 */
+        retval = add_to_pipe(pipe, &buf);
+        if (retval < 0)
+            break;
+        *ppos += chunk;
+        done += chunk;
+    }
+    if (done)
+        retval = done;
+
+out:
+    up_read(&dev->sem);
+    return retval;
+}
+
+/*
+ * mmap
+ * fault가 난 페이지가 속한 quantum을 찾아(공유 매핑에서 없으면 할당) 그 페이지를 그대로 매핑한다.
+ * 공유 쓰기 매핑에서는 장치 크기를 넘어선 곳을 건드리면 장치가 그만큼 늘어남
+ */
+void scull_vma_open(struct vm_area_struct *vma)
+{
+    struct scull_dev *dev = vma->vm_private_data;
+    atomic_inc(&dev->vmas);
+}
+
+void scull_vma_close(struct vm_area_struct *vma)
+{
+    struct scull_dev *dev = vma->vm_private_data;
+    atomic_dec(&dev->vmas);
+}
+
+vm_fault_t scull_vma_fault(struct vm_fault *vmf)
+{
+    struct vm_area_struct *vma = vmf->vma;
+    struct scull_dev *dev = vma->vm_private_data;
+    struct scull_qset *dptr;
+    unsigned long offset = vmf->pgoff << PAGE_SHIFT;
+    int quantum = dev->quantum, qset = dev->qset;
+    int itemsize = quantum * qset;
+    unsigned long item;
+    int s_pos, q_pos, rest;
+    int grow = (vma->vm_flags & (VM_SHARED | VM_WRITE)) == (VM_SHARED | VM_WRITE);
+    vm_fault_t retval = VM_FAULT_SIGBUS;
+    void *q = NULL;
+
+    item = offset / itemsize;
+    rest = offset % itemsize;
     s_pos = rest / quantum;
     q_pos = rest % quantum;
 
+    /* 이미 할당된 quantum이고 장치를 늘릴 필요가 없으면 read 락만으로 충분 */
+    down_read(&dev->sem);
+    if (offset >= dev->size && !grow) {
+        up_read(&dev->sem);
+        return retval;
+    }
     dptr = scull_follow(dev, item);
+    if (dptr && dptr->data)
+        q = dptr->data[s_pos];
+    if (q && (!grow || offset + PAGE_SIZE <= dev->size)) {
+        vmf->page = virt_to_page(q + q_pos);
+        get_page(vmf->page);
+        up_read(&dev->sem);
+        return 0;
+    }
+    /*
+     * 장치 안의 구멍: 공유 매핑이 아니면 장치에 써질 일이 없으므로 할당하지 않고 ZERO_PAGE를 매핑
+     * private 매핑의 쓰기 fault는 커널이 이 페이지를 복사(COW)해서 처리한다.
+     * 공유 매핑은 읽기 fault로 매핑한 페이지에도 그대로 쓸 수 있으므로 아래에서 할당
+     */
+    if (!q && !(vma->vm_flags & VM_SHARED)) {
+        vmf->page = ZERO_PAGE(vmf->address);
+        get_page(vmf->page);
+        up_read(&dev->sem);
+        return 0;
+    }
+    up_read(&dev->sem);
+
+    down_write(&dev->sem);
+    retval = VM_FAULT_OOM;
+    dptr = scull_follow_create(dev, item);
     if (!dptr)
         goto out;
 
     if (!dptr->data) {
-        dptr->data = kmalloc(qset * sizeof(char *), GFP_KERNEL);
+        dptr->data = scull_alloc_qset_data(dev);
         if (!dptr->data)
             goto out;
-        memset(dptr->data, 0, qset * sizeof(char *));
     }
 
     if (!dptr->data[s_pos]) {
-        dptr->data[s_pos] = kmalloc(quantum, GFP_KERNEL);
+        dptr->data[s_pos] = scull_alloc_quantum(dev);
         if (!dptr->data[s_pos])
             goto out;
     }
 
-    if (count > quantum - q_pos)
-        count = quantum - q_pos;
-
-    if (copy_from_user(dptr->data[s_pos] + q_pos, buf, count)) {
-        retval = -EFAULT;
-        goto out;
-    }
-
-    *f_pos += count;
-    retval = count;
+    vmf->page = virt_to_page(dptr->data[s_pos] + q_pos);
+    get_page(vmf->page);
 
-    if (dev->size < *f_pos)
-        dev->size = *f_pos;
+    if (grow && dev->size < offset + PAGE_SIZE)
+        dev->size = offset + PAGE_SIZE;
+    retval = 0;
 
 out:
-    up(&dev->sem);
+    up_write(&dev->sem);
     return retval;
 }
 
+static const struct vm_operations_struct scull_vm_ops = {
+    .open  = scull_vma_open,
+    .close = scull_vma_close,
+    .fault = scull_vma_fault,
+};
+
+int scull_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct scull_dev *dev = filp->private_data;
+
+    /* 페이지 모드가 아니면 페이지를 그대로 넘겨줄 수 없음 */
+    if (dev->order < 0)
+        return -ENODEV;
+
+    vma->vm_ops = &scull_vm_ops;
+    vma->vm_private_data = dev;
+    scull_vma_open(vma);
+    return 0;
+}
+
 static struct file_operations scull_fops = {
 	.owner = THIS_MODULE,
+	.llseek = scull_llseek,
 	.open = scull_open,
 	.release = scull_release,
-	.read = scull_read,
-	.write = scull_write,
+	.read_iter = scull_read_iter,
+	.write_iter = scull_write_iter,
+	.mmap = scull_mmap,
+	.splice_read = scull_splice_read,
+	.splice_write = iter_file_splice_write,
 };
 
+/* /proc/scull_mem: 장치 geometry와 quantum 풀 상태, hit/miss 횟수 */
+static int scull_proc_show(struct seq_file *s, void *v)
+{
+    struct scull_dev *dev = scull_device;
+
+    if(down_read_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+    seq_printf(s, "qset %i, q %i, order %i, sz %li\n", dev->qset, dev->quantum, dev->order, dev->size);
+    seq_printf(s, "pool %i/%i, hit %lu, miss %lu\n", dev->pool.count, scull_pool_max, dev->pool.hits, dev->pool.misses);
+    up_read(&dev->sem);
+    return 0;
+}
+
+/*
+ * 적재 시점의 geometry 크기로 slab 캐시를 만든다
+ * 페이지 모드의 quantum은 페이지 할당자에서 받으므로 quantum 캐시는 만들지 않음
+ */
+static int scull_create_caches(struct scull_dev *dev)
+{
+    scull_qset_cache = KMEM_CACHE(scull_qset, 0);
+    scull_data_cache = kmem_cache_create("scull_qset_data", dev->qset * sizeof(void *), 0, 0, NULL);
+    if(dev->order < 0)
+        scull_quantum_cache = kmem_cache_create("scull_quantum", dev->quantum, 0, 0, NULL);
+
+    if(!scull_qset_cache || !scull_data_cache || (dev->order < 0 && !scull_quantum_cache))
+        return -ENOMEM;
+    return 0;
+}
+
+static void scull_destroy_caches(void)
+{
+    kmem_cache_destroy(scull_quantum_cache);
+    kmem_cache_destroy(scull_data_cache);
+    kmem_cache_destroy(scull_qset_cache);
+}
+
 static void scull_setup_cdev(struct scull_dev *dev, int index)
 {
 	int err, devno = MKDEV(scull_major, scull_minor + index);
@@ -229,21 +853,39 @@ static int __init scull_init(void)
 		return -ENOMEM;
 	}
 	memset(scull_device, 0, sizeof(struct scull_dev));
-	scull_device->quantum = SCULL_QUANTUM;
-	scull_device->qset = SCULL_QSET;
-	sema_init(&scull_device->sem, 1);
+	if(scull_order > SCULL_ORDER_LIMIT)
+		scull_order = SCULL_ORDER_LIMIT;
+	if(scull_pool_max < scull_pool_size)
+		scull_pool_max = scull_pool_size;
+	scull_set_geometry(scull_device);
+	xa_init(&scull_device->qsets);
+	init_rwsem(&scull_device->sem);
+
+	if(scull_create_caches(scull_device)){
+		printk(KERN_ERR "scull_: failed to create slab caches\n");
+		scull_destroy_caches();
+		kfree(scull_device);
+		unregister_chrdev_region(dev, scull_nr_devs);
+		return -ENOMEM;
+	}
+	if(scull_pool_fill(scull_device, scull_pool_size))
+		printk(KERN_WARNING "scull_: pool filled with only %d quanta\n", scull_device->pool.count);
 
 	scull_setup_cdev(scull_device, 0);
+	proc_create_single("scull_mem", 0, NULL, scull_proc_show);
 	printk(KERN_NOTICE "scull_: registered with major %d\n", scull_major);
 	return 0;
 }
 
 static void __exit scull_exit(void)
 {
+	remove_proc_entry("scull_mem", NULL);
 	cdev_del(&scull_device->cdev);
 	unregister_chrdev_region(MKDEV(scull_major, scull_minor), scull_nr_devs);
 	scull_trim(scull_device);
+	scull_pool_drain(scull_device, scull_device->quantum, scull_device->order);
 	kfree(scull_device);
+	scull_destroy_caches();
 	printk(KERN_NOTICE "scull_: unregistered\n");
 }
 
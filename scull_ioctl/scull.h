@@ -2,6 +2,7 @@
 #define _SCULL_H
 
 #include<linux/ioctl.h>
+#include<linux/types.h>
 
 #ifndef SCULL_MAJOR
 #define SCULL_MAJOR 0
@@ -19,17 +20,44 @@
 #define SCULL_QSET 1000
 #endif
 
+#ifndef SCULL_ORDER
+#define SCULL_ORDER -1  /* 0 이상이면 페이지 모드 */
+#endif
+
+#define SCULL_ORDER_MAX 10
+
+#ifndef SCULL_POOL_SIZE
+#define SCULL_POOL_SIZE 0   /* 적재 시 장치별로 미리 확보할 quantum 수 */
+#endif
+
+#ifndef SCULL_POOL_MAX
+#define SCULL_POOL_MAX 64   /* 장치별 풀에 모아둘 수 있는 최대 quantum 수 */
+#endif
+
+#ifndef SCULL_FALLOC_MAX
+#define SCULL_FALLOC_MAX (256UL << 20)  /* SCULL_IOCFALLOC로 미리 할당할 수 있는 범위의 끝 (바이트) */
+#endif
+
 struct scull_qset{
     void **data;
-    struct scull_qset* next;
+};
+
+/* 장치별 quantum 풀 */
+struct scull_pool{
+    void *free;             /* 비어 있는 quantum의 free list */
+    int count;
+    unsigned long hits, misses;
 };
 
 struct scull_dev{
-    struct scull_qset *data;
+    struct xarray qsets;    /* item 번호 -> struct scull_qset */
     int quantum;
     int qset;
+    int order;              /* quantum 페이지 order, -1이면 kmalloc */
     unsigned long size;
-    struct semaphore sem;
+    atomic_t vmas;          /* 장치를 매핑하고 있는 vma 수 */
+    struct scull_pool pool;
+    struct rw_semaphore sem;    /* read는 공유, write/trim/할당은 배타 */
     struct cdev cdev;
 };
 
@@ -37,6 +65,9 @@ extern int scull_major;
 extern int scull_nr_devs;
 extern int scull_quantum;
 extern int scull_qset;
+extern int scull_order;
+extern int scull_pool_size;
+extern int scull_pool_max;
 
 #define SCULL_IOC_MAGIC 'k'
 /* 여러분의 코드에서는 이와 다른 8비트 숫자를 사용하라 */
@@ -65,8 +96,26 @@ extern int scull_qset;
 #define SCULL_IOCHQUANTUM _IO(SCULL_IOC_MAGIC, 11)
 #define SCULL_IOCHQSET    _IO(SCULL_IOC_MAGIC, 12)
 
+/* 13, 14는 scull_pipe용 (SCULL_P_IOCTSIZE, SCULL_P_IOCQSIZE) */
+
+/* quantum 페이지 order, 음수면 byte quantum 모드 */
+#define SCULL_IOCSORDER   _IOW(SCULL_IOC_MAGIC, 15, int)
+#define SCULL_IOCGORDER   _IOR(SCULL_IOC_MAGIC, 16, int)
+
+/*
+ * 범위 미리 할당, 구멍 뚫기 (fallocate(2)와 같은 의미)
+ * mode는 0, FALLOC_FL_KEEP_SIZE, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE
+ */
+struct scull_falloc{
+    __u32 mode;
+    __u32 pad;              /* 0, 32/64비트 사용자 공간에서 같은 크기가 되도록 */
+    __s64 offset;
+    __s64 len;
+};
+#define SCULL_IOCFALLOC   _IOW(SCULL_IOC_MAGIC, 17, struct scull_falloc)
+
 /* 최대 번호 (편의상 범위 체크용) */
-#define SCULL_IOC_MAXNR 14
+#define SCULL_IOC_MAXNR 17
 
 
 #endif
\ No newline at end of file
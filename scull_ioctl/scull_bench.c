@@ -0,0 +1,134 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<time.h>
+
+/*
+ * 여러 reader 스레드가 같은 scull 장치를 동시에 pread로 읽을 때의 처리량 측정
+ * 사용법: ./scull_bench [device] [device size(KiB)] [seconds] [max threads]
+ * 1, 2, 4, ... max threads 개의 스레드로 각각 측정하여 처리량을 출력
+ */
+
+static const char *path = "/dev/scull0";
+static size_t dev_size = 4096 * 1024;
+static int seconds = 3;
+static volatile int stop;
+
+/* 스레드별 카운터가 같은 캐시 라인을 공유하지 않도록 64바이트 정렬 */
+struct reader{
+    pthread_t tid;
+    unsigned long long bytes;
+} __attribute__((aligned(64)));
+
+static void *reader_main(void *arg)
+{
+    struct reader *r = arg;
+    char buf[64 * 1024];
+    unsigned long long bytes = 0;
+    off_t pos = 0;
+    ssize_t n;
+    int fd = open(path, O_RDONLY);
+
+    if(fd < 0){
+        perror("open");
+        return NULL;
+    }
+
+    while(!stop){
+        n = pread(fd, buf, sizeof(buf), pos);
+        if(n <= 0){
+            pos = 0;
+            continue;
+        }
+        bytes += n;
+        pos += n;
+    }
+
+    r->bytes = bytes;
+    close(fd);
+    return NULL;
+}
+
+/* 장치를 dev_size 만큼 채워둠, O_WRONLY open 시 scull_trim이 호출됨 */
+static int fill_device(void)
+{
+    char buf[64 * 1024];
+    size_t done = 0;
+    ssize_t n;
+    int fd = open(path, O_WRONLY);
+
+    if(fd < 0){
+        perror("open");
+        return -1;
+    }
+
+    memset(buf, 'a', sizeof(buf));
+    while(done < dev_size){
+        n = write(fd, buf, dev_size - done < sizeof(buf) ? dev_size - done : sizeof(buf));
+        if(n <= 0){
+            perror("write");
+            close(fd);
+            return -1;
+        }
+        done += n;
+    }
+
+    close(fd);
+    return 0;
+}
+
+static double run(int nthreads)
+{
+    struct reader *readers;
+    unsigned long long total = 0;
+    int i;
+
+    if(posix_memalign((void **)&readers, 64, nthreads * sizeof(struct reader)))
+        return 0;
+    memset(readers, 0, nthreads * sizeof(struct reader));
+
+    stop = 0;
+    for(i = 0; i < nthreads; i++)
+        pthread_create(&readers[i].tid, NULL, reader_main, &readers[i]);
+
+    sleep(seconds);
+    stop = 1;
+
+    for(i = 0; i < nthreads; i++){
+        pthread_join(readers[i].tid, NULL);
+        total += readers[i].bytes;
+    }
+
+    free(readers);
+    return (double)total / seconds / (1024 * 1024);
+}
+
+int main(int argc, char *argv[])
+{
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    double base = 0, mbps;
+    int n;
+
+    if(argc > 1) path = argv[1];
+    if(argc > 2) dev_size = strtoul(argv[2], NULL, 0) * 1024;
+    if(argc > 3) seconds = atoi(argv[3]);
+    if(argc > 4) max_threads = atoi(argv[4]);
+
+    if(fill_device())
+        return 1;
+
+    printf("%s: %zu KiB, %d s per run\n", path, dev_size / 1024, seconds);
+    printf("%8s %12s %8s\n", "threads", "MiB/s", "scale");
+    /* 1, 2, 4, ... 마지막은 max_threads */
+    for(n = 1; n <= max_threads; n = (n < max_threads && n * 2 > max_threads) ? max_threads : n * 2){
+        mbps = run(n);
+        if(n == 1)
+            base = mbps;
+        printf("%8d %12.1f %8.2f\n", n, mbps, base ? mbps / base : 0);
+    }
+
+    return 0;
+}
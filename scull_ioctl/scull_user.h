@@ -2,6 +2,7 @@
 #define _SCULL_USER_H_
 
 #include <linux/ioctl.h>
+#include <linux/types.h>
 
 #define SCULL_IOC_MAGIC 'k'
 /* 여러분의 코드에서는 이와 다른 8비트 숫자를 사용하라 */
@@ -30,8 +31,26 @@
 #define SCULL_IOCHQUANTUM _IO(SCULL_IOC_MAGIC, 11)
 #define SCULL_IOCHQSET    _IO(SCULL_IOC_MAGIC, 12)
 
+/* 13, 14는 scull_pipe용 (SCULL_P_IOCTSIZE, SCULL_P_IOCQSIZE) */
+
+/* quantum 페이지 order, 음수면 byte quantum 모드 */
+#define SCULL_IOCSORDER   _IOW(SCULL_IOC_MAGIC, 15, int)
+#define SCULL_IOCGORDER   _IOR(SCULL_IOC_MAGIC, 16, int)
+
+/*
+ * 범위 미리 할당, 구멍 뚫기 (fallocate(2)와 같은 의미)
+ * mode는 0, FALLOC_FL_KEEP_SIZE, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE
+ */
+struct scull_falloc{
+    __u32 mode;
+    __u32 pad;              /* 0, 32/64비트 사용자 공간에서 같은 크기가 되도록 */
+    __s64 offset;
+    __s64 len;
+};
+#define SCULL_IOCFALLOC   _IOW(SCULL_IOC_MAGIC, 17, struct scull_falloc)
+
 /* 최대 번호 (편의상 범위 체크용) */
-#define SCULL_IOC_MAXNR 14
+#define SCULL_IOC_MAXNR 17
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<poll.h>
+#include<pthread.h>
+#include<sched.h>
+#include<sys/ioctl.h>
+#include "scull_pipe_user.h"
+
+/*
+ * 여러 producer, consumer 스레드가 하나의 scullpipe로 데이터를 주고받을 때의 처리량 측정
+ * 장치의 ring 하나(off), CPU별 sub-ring(cpu), producer별 sub-ring(producer)을 차례로 측정
+ * 사용법: ./scull_p_mqbench [device] [seconds] [max threads] [chunk size]
+ * 1, 2, 4, ... max threads 쌍(producer + consumer)으로 측정, 스레드는 CPU에 하나씩 고정
+ */
+
+static const char *path = "/dev/scullpipe0";
+static int seconds = 3;
+static size_t chunk = 64;
+static volatile int stop;
+
+struct worker{
+    pthread_t tid;
+    int cpu;
+    int producer;
+    unsigned long long bytes;
+};
+
+static void pin(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct pollfd pfd;
+    char *buf = malloc(chunk);
+    ssize_t n;
+    int fd = open(path, (w->producer ? O_WRONLY : O_RDONLY) | O_NONBLOCK);
+
+    if(fd < 0){
+        perror("open");
+        free(buf);
+        return NULL;
+    }
+    pin(w->cpu);
+    memset(buf, 'm', chunk);
+    pfd.fd = fd;
+    pfd.events = w->producer ? POLLOUT : POLLIN;
+
+    /* Non-Blocking으로 열고 poll에 timeout을 두어 stop을 확인 */
+    while(!stop){
+        n = w->producer ? write(fd, buf, chunk) : read(fd, buf, chunk);
+        if(n > 0){
+            w->bytes += n;
+            continue;
+        }
+        if(n < 0 && errno != EAGAIN)
+            break;
+        poll(&pfd, 1, 100);
+    }
+
+    close(fd);
+    free(buf);
+    return NULL;
+}
+
+static double run(int pairs)
+{
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    struct worker *w = calloc(pairs * 2, sizeof(*w));
+    unsigned long long total = 0;
+    int i;
+
+    stop = 0;
+    for(i = 0; i < pairs * 2; i++){
+        w[i].cpu = i % ncpu;
+        w[i].producer = i & 1;
+        pthread_create(&w[i].tid, NULL, worker_main, &w[i]);
+    }
+    sleep(seconds);
+    stop = 1;
+    for(i = 0; i < pairs * 2; i++){
+        pthread_join(w[i].tid, NULL);
+        if(!w[i].producer)
+            total += w[i].bytes;
+    }
+    free(w);
+    return (double)total / seconds / (1024 * 1024);
+}
+
+/* 남은 데이터를 비움, 모드를 바꾸려면 비어 있어야 함 */
+static void drain(int fd)
+{
+    char buf[4096];
+
+    while(read(fd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *names[] = { "off", "cpu", "producer" };
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN) / 2;
+    int mode, n, fd;
+
+    if(argc > 1) path = argv[1];
+    if(argc > 2) seconds = atoi(argv[2]);
+    if(argc > 3) max_threads = atoi(argv[3]);
+    if(argc > 4) chunk = strtoul(argv[4], NULL, 0);
+    if(max_threads < 1) max_threads = 1;
+
+    /* 측정하는 동안 장치를 열어두어 크기와 모드를 유지 */
+    fd = open(path, O_RDWR | O_NONBLOCK);
+    if(fd < 0){
+        perror("open");
+        return 1;
+    }
+    if(ioctl(fd, SCULL_P_IOCTSIZE, 64 * 1024) < 0)
+        perror("ioctl SCULL_P_IOCTSIZE");
+
+    printf("%s: %zu byte chunks, %d s per run\n", path, chunk, seconds);
+    printf("%10s %8s %12s\n", "mode", "pairs", "MiB/s");
+    for(mode = SCULL_P_MQ_OFF; mode <= SCULL_P_MQ_PRODUCER; mode++){
+        drain(fd);
+        if(ioctl(fd, SCULL_P_IOCTMQ, mode) < 0){
+            perror("ioctl SCULL_P_IOCTMQ");
+            continue;
+        }
+        /* 1, 2, 4, ... 마지막은 max_threads */
+        for(n = 1; n <= max_threads; n = (n < max_threads && n * 2 > max_threads) ? max_threads : n * 2){
+            printf("%10s %8d %12.1f\n", names[mode], n, run(n));
+            drain(fd);
+        }
+    }
+    drain(fd);
+    ioctl(fd, SCULL_P_IOCTMQ, SCULL_P_MQ_OFF);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<pthread.h>
+#include<sched.h>
+#include<time.h>
+#include<sys/ioctl.h>
+#include "scull_pipe_user.h"
+
+/*
+ * 두 스레드를 서로 다른 코어에 고정하고 scullpipe 두 개로 ping-pong 왕복 지연 측정
+ * ping: pipe0에 쓰고 pipe1에서 읽음, pong: pipe0에서 읽고 pipe1에 씀
+ * 사용법: ./scull_p_pingpong [pipe0] [pipe1] [iterations] [msg size] [cpu0] [cpu1]
+ * 세마포어 모드와 SPSC 모드를 차례로 측정하여 평균 왕복 시간을 출력
+ */
+
+static const char *path0 = "/dev/scullpipe0";
+static const char *path1 = "/dev/scullpipe1";
+static long iters = 100000;
+static size_t msg = 8;
+static int cpu0 = 0, cpu1 = 1;
+
+struct side{
+    int cpu;
+    int in, out;
+};
+
+static void pin(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+        fprintf(stderr, "cpu %d: affinity failed\n", cpu);
+}
+
+/* 메시지 하나를 끝까지 읽거나 씀 */
+static int xfer(int fd, char *buf, size_t len, int wr)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while(done < len){
+        n = wr ? write(fd, buf + done, len - done) : read(fd, buf + done, len - done);
+        if(n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+static void *pong_main(void *arg)
+{
+    struct side *s = arg;
+    char *buf = malloc(msg);
+    long i;
+
+    pin(s->cpu);
+    for(i = 0; i < iters; i++){
+        if(xfer(s->in, buf, msg, 0) || xfer(s->out, buf, msg, 1)){
+            perror("pong");
+            break;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+static double run(int spsc)
+{
+    struct side ping, pong;
+    struct timespec t0, t1;
+    pthread_t tid;
+    char *buf = malloc(msg);
+    long i;
+
+    /* 각 pipe는 reader 하나, writer 하나로만 열림 */
+    ping.out = open(path0, O_WRONLY);
+    pong.in = open(path0, O_RDONLY);
+    pong.out = open(path1, O_WRONLY);
+    ping.in = open(path1, O_RDONLY);
+    if(ping.out < 0 || pong.in < 0 || pong.out < 0 || ping.in < 0){
+        perror("open");
+        exit(1);
+    }
+    if(ioctl(ping.out, SCULL_P_IOCTSPSC, spsc) || ioctl(pong.out, SCULL_P_IOCTSPSC, spsc)){
+        perror("ioctl SCULL_P_IOCTSPSC");
+        exit(1);
+    }
+
+    memset(buf, 'p', msg);
+    ping.cpu = cpu0;
+    pong.cpu = cpu1;
+    pthread_create(&tid, NULL, pong_main, &pong);
+    pin(ping.cpu);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(i = 0; i < iters; i++){
+        if(xfer(ping.out, buf, msg, 1) || xfer(ping.in, buf, msg, 0)){
+            perror("ping");
+            break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    pthread_join(tid, NULL);
+
+    close(ping.out);
+    close(pong.in);
+    close(pong.out);
+    close(ping.in);
+    free(buf);
+
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / iters;
+}
+
+int main(int argc, char *argv[])
+{
+    double locked, spsc;
+
+    if(argc > 1) path0 = argv[1];
+    if(argc > 2) path1 = argv[2];
+    if(argc > 3) iters = atol(argv[3]);
+    if(argc > 4) msg = strtoul(argv[4], NULL, 0);
+    if(argc > 5) cpu0 = atoi(argv[5]);
+    if(argc > 6) cpu1 = atoi(argv[6]);
+
+    printf("%s <-> %s: %ld round trips, %zu bytes, cpu %d/%d\n",
+           path0, path1, iters, msg, cpu0, cpu1);
+    locked = run(0);
+    spsc = run(1);
+    printf("%10s %12s\n", "mode", "RTT(ns)");
+    printf("%10s %12.0f\n", "semaphore", locked);
+    printf("%10s %12.0f\n", "spsc", spsc);
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<poll.h>
+#include<time.h>
+#include<sys/ioctl.h>
+#include<sys/mman.h>
+#include<sys/wait.h>
+#include "scull_pipe_user.h"
+
+/*
+ * scullpipe mmap ring 예제
+ * producer(부모)와 consumer(자식)가 같은 ring을 매핑하고 8바이트 일련번호를 syscall 없이 주고받음
+ * 비어 있다가 채워졌을 때, 가득 찼다가 비워졌을 때만 SCULL_P_IOCRINGWAKE 호출
+ * 사용법: ./scull_p_ring [device] [ring size(KiB)] [count]
+ */
+
+static const char *path = "/dev/scullpipe0";
+static size_t ring_size = 64 * 1024;
+static unsigned long count = 10000000;
+static long page_size;
+
+struct ring{
+    int fd;
+    struct scull_p_ring_ctrl *ctrl;
+    char *data;
+    uint32_t size;
+    unsigned long wakeups;
+};
+
+static int ring_map(struct ring *r)
+{
+    void *p;
+
+    r->fd = open(path, O_RDWR);
+    if(r->fd < 0){
+        perror("open");
+        return -1;
+    }
+    // 다른 프로세스가 장치 세마포어를 잡고 있으면 -EAGAIN이므로 다시 시도
+    do{
+        p = mmap(NULL, page_size + ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+    }while(p == MAP_FAILED && errno == EAGAIN);
+    if(p == MAP_FAILED){
+        perror("mmap");
+        return -1;
+    }
+    r->ctrl = p;
+    r->data = (char *)p + page_size;
+    r->size = r->ctrl->size;
+    r->wakeups = 0;
+    return 0;
+}
+
+static void ring_wait(struct ring *r, short events)
+{
+    struct pollfd pfd = { .fd = r->fd, .events = events };
+    poll(&pfd, 1, -1);
+}
+
+static void producer(struct ring *r)
+{
+    uint32_t head, tail;
+    uint64_t seq;
+
+    for(seq = 0; seq < count; ){
+        head = r->ctrl->head;
+        tail = __atomic_load_n(&r->ctrl->tail, __ATOMIC_ACQUIRE);
+        if((tail + r->size - head - 1) % r->size < sizeof(seq)){
+            ring_wait(r, POLLOUT);
+            continue;
+        }
+
+        /* size가 8의 배수이므로 메시지가 ring 끝에서 나뉘지 않음 */
+        memcpy(r->data + head, &seq, sizeof(seq));
+        __atomic_store_n(&r->ctrl->head, (head + sizeof(seq)) % r->size, __ATOMIC_RELEASE);
+        seq++;
+
+        /* head 공개 이후의 tail로 비어 있던 ring인지 확인해야 wakeup을 놓치지 않음 */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if(__atomic_load_n(&r->ctrl->tail, __ATOMIC_ACQUIRE) == head){
+            ioctl(r->fd, SCULL_P_IOCRINGWAKE, SCULL_P_RING_IN);
+            r->wakeups++;
+        }
+    }
+}
+
+static int consumer(struct ring *r)
+{
+    uint32_t head, tail;
+    uint64_t seq, expect;
+
+    for(expect = 0; expect < count; ){
+        tail = r->ctrl->tail;
+        head = __atomic_load_n(&r->ctrl->head, __ATOMIC_ACQUIRE);
+        if(head == tail){
+            ring_wait(r, POLLIN);
+            continue;
+        }
+
+        memcpy(&seq, r->data + tail, sizeof(seq));
+        if(seq != expect){
+            fprintf(stderr, "consumer: expected %llu, got %llu\n",
+                    (unsigned long long)expect, (unsigned long long)seq);
+            return 1;
+        }
+        expect++;
+        __atomic_store_n(&r->ctrl->tail, (tail + sizeof(seq)) % r->size, __ATOMIC_RELEASE);
+
+        /* 비우기 전의 tail 기준으로 producer가 기다릴 만큼 가득 차 있었다면 깨움 */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        head = __atomic_load_n(&r->ctrl->head, __ATOMIC_ACQUIRE);
+        if((tail + r->size - head - 1) % r->size < sizeof(seq)){
+            ioctl(r->fd, SCULL_P_IOCRINGWAKE, SCULL_P_RING_OUT);
+            r->wakeups++;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct ring r;
+    struct timespec t0, t1;
+    double sec;
+    pid_t pid;
+    int fd, status;
+
+    page_size = sysconf(_SC_PAGESIZE);
+    if(argc > 1) path = argv[1];
+    if(argc > 2) ring_size = strtoul(argv[2], NULL, 0) * 1024;
+    if(argc > 3) count = strtoul(argv[3], NULL, 0);
+
+    /* ring 크기는 페이지 단위여야 mmap 가능, 열려 있는 동안 크기와 버퍼가 유지됨 */
+    fd = open(path, O_RDWR);
+    if(fd < 0){
+        perror("open");
+        return 1;
+    }
+    if(ioctl(fd, SCULL_P_IOCTSIZE, ring_size) < 0){
+        perror("ioctl SCULL_P_IOCTSIZE");
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pid = fork();
+    if(pid == 0){
+        if(ring_map(&r))
+            exit(1);
+        status = consumer(&r);
+        printf("consumer: %lu wakeups\n", r.wakeups);
+        exit(status);
+    }
+
+    if(ring_map(&r))
+        return 1;
+    producer(&r);
+    waitpid(pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("producer: %lu wakeups\n", r.wakeups);
+    printf("%lu messages in %.3f s, %.1f M msg/s%s\n", count, sec, count / sec / 1e6,
+           WEXITSTATUS(status) ? " (consumer failed)" : "");
+    close(fd);
+    return WEXITSTATUS(status);
+}
@@ -13,35 +13,1068 @@
 #include <linux/poll.h>
 #include <linux/sched.h>
 #include <linux/sched/signal.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/cred.h>
+#include <linux/capability.h>
+#include <linux/shrinker.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu-rwsem.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 #include "scull.h"
 
+#define CREATE_TRACE_POINTS
+#include "scull_pipe_trace.h"
+
 // scull pipe 장치 구조체
 struct scull_pipe{
     wait_queue_head_t inq, outq;       // 특정 이벤트를 기다리는 대기 큐 (read, write)
-    char *buffer, *end;                // 장치 버퍼 포인터
+    char *buffer;                      // 장치 버퍼 포인터
     int buffersize;                    // 버퍼 크기
-    char *rp, *wp;                     // read, write 포인터
+    int ringsize;                      // ioctl로 지정한 버퍼 크기, 0이면 scull_p_buffer 사용
+    kuid_t owner;                      // ringsize를 지정한 사용자, 사용자별 한도 계산에 사용
+    unsigned int rp, wp;               // read, write 위치 (buffer 기준 offset)
     int nreaders, nwriters;            // reader, writer 수
-    struct fasync_struct *async_queue; // 비동기 알람을 위한 큐, cat <-> echo 방식에서는 의미 없음
+    int spsc;                          // SPSC 모드: reader, writer 각 1개, data path에서 세마포어 사용 안 함
+    int fullwrite;                     // 요청한 count를 모두 쓸 때까지 blocking 하는 모드
+    int persist;                       // 마지막 close 이후에도 버퍼와 데이터를 유지
+    int packet;                        // record 모드: write 하나가 record 하나, read는 record 하나씩
+    struct scull_p_ring_ctrl *ring;    // mmap용 control page, 매핑된 동안 rp, wp는 여기에 있음
+    atomic_t vmas;                     // 매핑된 vma 수
+    spinlock_t ring_lock;              // vmas의 0 <-> 1 전이와 rp, wp <-> head, tail 인계 보호
+    int fanout;                        // SCULL_P_FANOUT_*: reader마다 따로 읽는 모드
+    u64 wseq;                          // fan-out 모드에서 지금까지 쓴 바이트 수
+    struct list_head readers;          // 읽기로 연 파일들 (struct scull_p_file)
+    int rcvlowat;                      // reader는 이만큼 쌓이거나 rcvtimeo가 지나야 깨어남
+    int sndlowat;                      // writer는 이만큼 비어야 깨어남
+    long rcvtimeo;                     // rcvlowat을 기다리는 최대 시간 (jiffies), 0이면 무한
+    int overwrite;                     // 가득 차면 writer를 재우지 않고 가장 오래된 데이터를 버림
+    u64 overrun;                       // overwrite 모드에서 지금까지 버린 바이트 수
+    u64 lost;                          // 아직 reader에게 알리지 않은 버린 바이트 수
+    u64 lost_last;                     // 마지막으로 -EOVERFLOW로 알린 구간에서 버린 바이트 수
+    u64 gaps;                          // -EOVERFLOW로 알린 횟수
+    int mq;                            // SCULL_P_MQ_*: 여러 sub-ring으로 나눠 쓰는 모드
+    int nqueues;                       // sub-ring 수
+    unsigned int qsize;                // sub-ring 하나의 크기
+    unsigned int nextq;                // producer 모드에서 다음 writer에게 줄 sub-ring
+    struct scull_p_queue *queues;      // sub-ring 배열
+    struct percpu_rw_semaphore mq_sem; // queues 배열 보호, data path는 read, 모드 변경은 write
+    int drop;                          // 마지막 close 때 persist와 관계없이 버퍼 해제
+    struct list_head async_files;      // fasync를 등록한 파일들 (struct scull_p_file), sig_lock으로 보호
+    spinlock_t sig_lock;
+    int sigflags;                      // SCULL_P_SIGIO_*
+    unsigned long sig_interval;        // SIGIO 사이 최소 간격 (jiffies), 0이면 제한 없음
+    unsigned long sig_next;            // 다음 SIGIO를 보낼 수 있는 시각
+    unsigned int sig_pending;          // 간격 제한으로 미룬 SIGIO (SCULL_P_SIG_IN / OUT)
+    unsigned int sig_rr;               // SCULL_P_SIGIO_ONE 모드에서 다음에 받을 파일 순번
+    unsigned long sig_armed;           // edge 모드: 비었다가(가득 찼다가) 다시 준비되면 보낼 SIGIO
+    struct timer_list sig_timer;       // 미룬 SIGIO를 간격이 지난 뒤 전송
+    struct scull_p_stats __percpu *stats; // CPU별 통계, /proc/scullpipe에서 합산
+    struct scull_p_stamp *stamps;      // timestamp 모드의 side ring, NULL이면 꺼짐
+    unsigned int ts_head, ts_tail;     // stamps의 넣을 위치, 꺼낼 위치 (SCULL_P_TS_MAX로 나눈 나머지 사용)
+    u64 in_seq, out_seq;               // timestamp 모드에서 지금까지 쓴, 읽은 바이트 수
     struct semaphore sem;
     struct cdev cdev;
 };
 
+/*
+* multi-queue 모드의 sub-ring
+* 각자 세마포어를 가지므로 서로 다른 sub-ring의 reader, writer는 경합하지 않음
+*/
+struct scull_p_queue{
+    struct semaphore sem;
+    char *buffer;
+    unsigned int rp, wp;
+} ____cacheline_aligned_in_smp;
+
+/*
+* open마다 만들어지는 파일별 상태, filp->private_data
+* fan-out 모드에서 reader마다 따로 가지는 읽기 위치
+*/
+struct scull_p_file{
+    struct scull_pipe *dev;
+    struct list_head list;             // dev->readers
+    unsigned int rp;                   // 이 reader의 read 위치
+    u64 seq;                           // 이 reader가 지금까지 읽은 위치, dev->wseq와 비교
+    unsigned int queue;                // producer 모드에서 이 writer가 쓰는 sub-ring
+    fmode_t mode;                      // POLL_IN은 reader에게, POLL_OUT은 writer에게만 전송
+    struct fasync_struct *async;       // 이 파일의 fasync 등록
+    struct list_head alist;            // dev->async_files
+    struct scull_p_tstamp ts;          // timestamp 모드에서 마지막 read가 읽은 데이터의 적재 시각
+};
+
+/*
+* 통계
+* data path에서는 현재 CPU의 카운터만 올리고 /proc/scullpipe에서 읽을 때 모든 CPU를 합산
+* histogram은 log2 구간: 0번은 0, k번은 [2^(k-1), 2^k)
+*/
+#define SCULL_P_HIST  32
+#define SCULL_P_RD    0
+#define SCULL_P_WR    1
+
+struct scull_p_stats{
+    u64 bytes[2];                      // 읽은(쓴) 바이트 수
+    u64 ops[2];                        // 데이터를 옮긴 read(write) 수, record 모드는 record 수
+    u64 sleeps[2];                     // 잠든 횟수
+    u64 wakeups[2];                    // 잠든 reader(writer)를 깨운 횟수
+    u64 eagain[2];                     // -EAGAIN 반환 횟수
+    u64 wait_us[2];                    // 잠들어 있던 시간의 합
+    u64 wait_hist[2][SCULL_P_HIST];    // 한 번 잠들어 있던 시간 (us)
+    u64 fill_hist[SCULL_P_HIST];       // write 직후 ring에 쌓인 바이트 수
+    u64 delay_hist[SCULL_P_HIST];      // timestamp 모드에서 write 구간이 ring에 머문 시간 (us)
+};
+
+static inline unsigned int scull_p_hist_slot(u64 v)
+{
+    return min_t(unsigned int, fls64(v), SCULL_P_HIST - 1);
+}
+
+static inline struct scull_pipe *scull_p_dev(struct file *filp)
+{
+    return ((struct scull_p_file *)filp->private_data)->dev;
+}
+
 int scull_p_nr_devs = SCULL_P_NR_DEVS;
 int scull_p_buffer = SCULL_P_BUFFER;
+int scull_p_max_size = SCULL_P_MAX_SIZE;   // 일반 사용자가 지정할 수 있는 장치별 최대 크기
+int scull_p_user_max = SCULL_P_USER_MAX;   // 일반 사용자가 지정할 수 있는 크기의 합
+int scull_p_spsc = 0;                  // 적재 시 모든 장치의 SPSC 모드 기본값
+int scull_p_fullwrite = 0;             // 적재 시 모든 장치의 full write 모드 기본값
+int scull_p_persist = 0;               // 적재 시 모든 장치의 persist 모드 기본값, 켜면 버퍼를 미리 할당
+int scull_p_packet = 0;                // 적재 시 모든 장치의 record 모드 기본값
+int scull_p_fanout = SCULL_P_FANOUT_OFF; // 적재 시 모든 장치의 fan-out 모드 기본값
+int scull_p_mq_queues = 0;             // multi-queue 모드의 sub-ring 수, 0이면 CPU 수
+int scull_p_overwrite = 0;             // 적재 시 모든 장치의 overwrite 모드 기본값
+int scull_p_tstamp = 0;                // 적재 시 모든 장치의 timestamp 모드 기본값
+int scull_p_sigio = 0;                 // 적재 시 모든 장치의 SIGIO 모드 (SCULL_P_SIGIO_*)
+int scull_p_sigio_ms = 0;              // ms, 0이면 간격 제한 없음
+int scull_p_rcvlowat = 1;              // 적재 시 모든 장치의 watermark 기본값 (바이트)
+int scull_p_sndlowat = 1;
+int scull_p_rcvtimeo = 0;              // ms, 0이면 무한
 dev_t scull_p_devno;
 struct scull_pipe *scull_p_devices;
 
+/* tracepoint에 남기는 장치 번호 */
+static inline int scull_p_index(struct scull_pipe *dev)
+{
+    return dev - scull_p_devices;
+}
+
+static void scull_p_stat_xfer(struct scull_pipe *dev, int dir, size_t bytes)
+{
+    this_cpu_add(dev->stats->bytes[dir], bytes);
+    this_cpu_inc(dev->stats->ops[dir]);
+}
+
+static void scull_p_stat_fill(struct scull_pipe *dev, unsigned int used)
+{
+    this_cpu_inc(dev->stats->fill_hist[scull_p_hist_slot(used)]);
+}
+
+/* start(ktime_get_ns)부터 잠들어 있던 시간 기록 */
+static void scull_p_stat_wait(struct scull_pipe *dev, int dir, u64 start)
+{
+    u64 us = div_u64(ktime_get_ns() - start, NSEC_PER_USEC);
+
+    this_cpu_inc(dev->stats->sleeps[dir]);
+    this_cpu_add(dev->stats->wait_us[dir], us);
+    this_cpu_inc(dev->stats->wait_hist[dir][scull_p_hist_slot(us)]);
+}
+
+static void scull_p_stat_eagain(struct scull_pipe *dev, int dir)
+{
+    this_cpu_inc(dev->stats->eagain[dir]);
+}
+
+module_param(scull_p_buffer, int, S_IRUGO | S_IWUSR);
+module_param(scull_p_max_size, int, S_IRUGO | S_IWUSR);
+module_param(scull_p_user_max, int, S_IRUGO | S_IWUSR);
+module_param(scull_p_spsc, int, S_IRUGO);
+module_param(scull_p_fullwrite, int, S_IRUGO);
+module_param(scull_p_persist, int, S_IRUGO);
+module_param(scull_p_packet, int, S_IRUGO);
+module_param(scull_p_fanout, int, S_IRUGO);
+module_param(scull_p_mq_queues, int, S_IRUGO | S_IWUSR);
+module_param(scull_p_overwrite, int, S_IRUGO);
+module_param(scull_p_tstamp, int, S_IRUGO);
+module_param(scull_p_sigio, int, S_IRUGO);
+module_param(scull_p_sigio_ms, int, S_IRUGO);
+module_param(scull_p_rcvlowat, int, S_IRUGO);
+module_param(scull_p_sndlowat, int, S_IRUGO);
+module_param(scull_p_rcvtimeo, int, S_IRUGO);
+
+/*
+* 장치가 mmap되어 있는지 확인
+* 마지막 매핑 해제는 dev->sem 없이 rp, wp를 되돌려 놓은 뒤 release로 vmas를 내리므로 acquire로 읽음
+*/
+static inline int scull_p_mapped(struct scull_pipe *dev)
+{
+    return atomic_read_acquire(&dev->vmas);
+}
+
+/*
+* rp, wp 공개 규칙
+* rp는 reader만, wp는 writer만 변경
+* 데이터를 복사한 뒤 smp_store_release로 자신의 위치를 공개하고
+* 상대 위치는 smp_load_acquire로 읽으므로 SPSC 모드에서는 락 없이도
+* reader는 wp 이전의 데이터가, writer는 rp 이전의 빈 공간이 보장됨
+*/
+
+/* 읽을 수 있는 바이트 수 */
+static unsigned int scull_p_avail(struct scull_pipe *dev)
+{
+    unsigned int wp = smp_load_acquire(&dev->wp);
+    return (wp + dev->buffersize - READ_ONCE(dev->rp)) % dev->buffersize;
+}
+
+/* 
+* spacefree helper
+* 1. dev->rp == dev->wp
+*   : rp = wp인 경우는 버퍼가 비어있는 경우 뿐
+*   : 따라서 buffersize - 1만큼 반환
+* 2. 아닌 경우 남아 있는 만큼 반환 
+*/
+int spacefree(struct scull_pipe *dev)
+{
+    unsigned int rp = smp_load_acquire(&dev->rp);
+    return (rp + dev->buffersize - READ_ONCE(dev->wp) - 1) % dev->buffersize;
+}
+
+/*
+* watermark
+* SO_RCVLOWAT / SO_SNDLOWAT과 같이 reader는 rcvlowat 바이트가 쌓여야, writer는 sndlowat 바이트가 비어야 깨움
+* 버퍼보다 큰 값은 의미가 없으므로 buffersize - 1로 제한
+* poll도 같은 기준으로 POLLIN, POLLOUT을 알림
+*/
+static unsigned int scull_p_rcvlowat(struct scull_pipe *dev)
+{
+    return clamp_t(int, READ_ONCE(dev->rcvlowat), 1, dev->buffersize - 1);
+}
+
+static unsigned int scull_p_sndlowat(struct scull_pipe *dev)
+{
+    return clamp_t(int, READ_ONCE(dev->sndlowat), 1, dev->buffersize - 1);
+}
+
+/*
+* wakeup
+* blocking reader, writer는 exclusive로 대기하므로 wakeup 한 번에 하나만 깨어남
+*   └ 깨어난 쪽이 데이터(공간)를 다 쓰지 못하면 다음 대기자를 이어서 깨움
+* poll 대기자는 EPOLLIN / EPOLLOUT key로 깨워 관심 없는 쪽과 EPOLLEXCLUSIVE 대기자는 건너뜀
+* 모드, 크기, watermark 변경처럼 조건 자체가 바뀌는 경우에는 wake_up_interruptible_all 사용
+*/
+#define SCULL_P_POLLIN   (EPOLLIN | EPOLLRDNORM)
+#define SCULL_P_POLLOUT  (EPOLLOUT | EPOLLWRNORM)
+
+/* wait_event_interruptible_timeout의 exclusive 버전 */
+#define scull_p_wait_exclusive_timeout(wq, condition, timeout)                  \
+({                                                                              \
+    long __ret = timeout;                                                       \
+    if(!___wait_cond_timeout(condition))                                        \
+        __ret = ___wait_event(wq, ___wait_cond_timeout(condition),             \
+                              TASK_INTERRUPTIBLE, 1, timeout,                   \
+                              __ret = schedule_timeout(__ret));                 \
+    __ret;                                                                      \
+})
+
+/*
+* SIGIO
+* 파일마다 fasync를 따로 등록하여 POLL_IN은 reader에게, POLL_OUT은 writer에게만 전송
+* SCULL_P_SIGIO_EDGE: 비어 있다가(rcvlowat 미만) 데이터가 생길 때, 가득 찼다가(sndlowat 미만) 공간이 생길 때만 전송
+* SCULL_P_SIGIO_ONE: 등록한 파일 중 하나에만 돌아가며 전송
+* sig_interval: 간격 안에 다시 보내야 하면 timer로 미뤘다가 한 번에 전송
+*/
+#define SCULL_P_SIG_IN   0
+#define SCULL_P_SIG_OUT  1
+
+static void scull_p_sigio_locked(struct scull_pipe *dev, int sig)
+{
+    fmode_t mode = sig == SCULL_P_SIG_IN ? FMODE_READ : FMODE_WRITE;
+    int band = sig == SCULL_P_SIG_IN ? POLL_IN : POLL_OUT;
+    struct scull_p_file *pf;
+    unsigned int n = 0;
+
+    list_for_each_entry(pf, &dev->async_files, alist){
+        if(!(pf->mode & mode))
+            continue;
+        if(dev->sigflags & SCULL_P_SIGIO_ONE)
+            n++;
+        else
+            kill_fasync(&pf->async, SIGIO, band);
+    }
+    if(!n)
+        return;
+
+    n = dev->sig_rr++ % n;
+    list_for_each_entry(pf, &dev->async_files, alist){
+        if((pf->mode & mode) && !n--){
+            kill_fasync(&pf->async, SIGIO, band);
+            break;
+        }
+    }
+}
+
+static void scull_p_sigio(struct scull_pipe *dev, int sig)
+{
+    unsigned long flags;
+
+    if(list_empty_careful(&dev->async_files))
+        return;
+
+    spin_lock_irqsave(&dev->sig_lock, flags);
+    if(dev->sig_interval && time_before(jiffies, dev->sig_next)){
+        dev->sig_pending |= BIT(sig);
+        if(!timer_pending(&dev->sig_timer))
+            mod_timer(&dev->sig_timer, dev->sig_next);
+    }else{
+        dev->sig_next = jiffies + dev->sig_interval;
+        scull_p_sigio_locked(dev, sig);
+    }
+    spin_unlock_irqrestore(&dev->sig_lock, flags);
+}
+
+static void scull_p_sig_timer(struct timer_list *t)
+{
+    struct scull_pipe *dev = container_of(t, struct scull_pipe, sig_timer);
+    unsigned long flags;
+
+    spin_lock_irqsave(&dev->sig_lock, flags);
+    dev->sig_next = jiffies + dev->sig_interval;
+    if(dev->sig_pending & BIT(SCULL_P_SIG_IN))
+        scull_p_sigio_locked(dev, SCULL_P_SIG_IN);
+    if(dev->sig_pending & BIT(SCULL_P_SIG_OUT))
+        scull_p_sigio_locked(dev, SCULL_P_SIG_OUT);
+    dev->sig_pending = 0;
+    spin_unlock_irqrestore(&dev->sig_lock, flags);
+}
+
+/*
+* edge 모드에서 이번 전이에 SIGIO를 보낼지 확인
+* fan-out 모드는 reader마다 위치가 달라 비어 있는 상태를 알 수 없으므로 매번 전송
+*/
+static int scull_p_sig_edge(struct scull_pipe *dev, int sig)
+{
+    return !(READ_ONCE(dev->sigflags) & SCULL_P_SIGIO_EDGE) || dev->fanout ||
+           test_and_clear_bit(sig, &dev->sig_armed);
+}
+
+/* 대기 중인 reader 하나와 EPOLLIN poll 대기자를 깨움 */
+static void scull_p_wake_next_reader(struct scull_pipe *dev)
+{
+    if(wq_has_sleeper(&dev->inq)){
+        this_cpu_inc(dev->stats->wakeups[SCULL_P_RD]);
+        trace_scull_p_wake(scull_p_index(dev), false, scull_p_avail(dev), scull_p_avail(dev));
+        wake_up_interruptible_poll(&dev->inq, SCULL_P_POLLIN);
+    }
+}
+
+/*
+* edge 모드의 다음 POLL_IN, POLL_OUT 준비
+* rp, wp를 공개한 임계 구역 안에서 호출, 세마포어를 놓은 뒤에 준비하면
+* 그 사이 상대편이 다시 채우거나(비우거나) edge 확인을 먼저 해버려 SIGIO를 놓침
+*/
+static void scull_p_sig_arm(struct scull_pipe *dev)
+{
+    if(scull_p_avail(dev) < scull_p_rcvlowat(dev))
+        set_bit(SCULL_P_SIG_IN, &dev->sig_armed);
+    if(spacefree(dev) < scull_p_sndlowat(dev))
+        set_bit(SCULL_P_SIG_OUT, &dev->sig_armed);
+}
+
+/* rcvlowat 이상 쌓였을 때만 reader를 깨우고 SIGIO 전송, fan-out 모드는 reader마다 위치가 달라 항상 깨움 */
+static void scull_p_wake_readers(struct scull_pipe *dev)
+{
+    if(!dev->fanout && scull_p_avail(dev) < scull_p_rcvlowat(dev))
+        return;
+    scull_p_wake_next_reader(dev);
+    if(scull_p_sig_edge(dev, SCULL_P_SIG_IN))
+        scull_p_sigio(dev, SCULL_P_SIG_IN);
+}
+
+/* 
+* read 이후 데이터가 rcvlowat 이상 남아 있으면 다음 reader를 깨움
+* fan-out 모드의 reader는 exclusive로 대기하지 않으므로 필요 없음
+*/
+static void scull_p_pass_readers(struct scull_pipe *dev)
+{
+    if(dev->fanout)
+        return;
+    if(scull_p_avail(dev) >= scull_p_rcvlowat(dev))
+        scull_p_wake_next_reader(dev);
+}
+
+/*
+* sndlowat 이상 비었을 때만 writer를 깨움, write 이후에 부르면 남은 공간으로 다음 writer를 깨움
+* 0이 아니면 공간이 있음
+*/
+static int scull_p_wake_writers(struct scull_pipe *dev)
+{
+    if(spacefree(dev) < scull_p_sndlowat(dev))
+        return 0;
+    if(wq_has_sleeper(&dev->outq)){
+        this_cpu_inc(dev->stats->wakeups[SCULL_P_WR]);
+        trace_scull_p_wake(scull_p_index(dev), true, spacefree(dev), scull_p_avail(dev));
+        wake_up_interruptible_poll(&dev->outq, SCULL_P_POLLOUT);
+    }
+    return 1;
+}
+
+/* read 이후: writer를 깨우고 POLL_OUT 전송, 데이터가 남아 있으면 다음 reader를 깨움 */
+static void scull_p_read_done(struct scull_pipe *dev)
+{
+    if(scull_p_wake_writers(dev) && (READ_ONCE(dev->sigflags) & SCULL_P_SIGIO_OUT) &&
+       scull_p_sig_edge(dev, SCULL_P_SIG_OUT))
+        scull_p_sigio(dev, SCULL_P_SIG_OUT);
+    scull_p_pass_readers(dev);
+}
+
+/*
+* full write 모드에서 원자적으로 쓰는 최대 크기
+* pipe의 PIPE_BUF와 같은 의미, 버퍼에 한 번에 들어갈 수 있는 크기로 제한
+*/
+static size_t scull_p_atomic(struct scull_pipe *dev)
+{
+    return min_t(size_t, PIPE_BUF, dev->buffersize - 1);
+}
+
+/*
+* ring copy helper
+* pos부터 count만큼 복사, end를 넘어가면 나머지를 버퍼 처음부터 이어서 복사
+*   ├ --pos----end
+*   └ 0--------    (wrap)
+* 실제로 복사한 바이트 수 반환
+*/
+static size_t scull_p_ring_copy_out(char *buffer, unsigned int size, unsigned int pos,
+                                    size_t count, struct iov_iter *to)
+{
+    size_t first = min(count, (size_t)(size - pos));
+    size_t copied = copy_to_iter(buffer + pos, first, to);
+
+    if(copied == first && count > first)
+        copied += copy_to_iter(buffer, count - first, to);
+    return copied;
+}
+
+static size_t scull_p_ring_copy_in(char *buffer, unsigned int size, unsigned int pos,
+                                   size_t count, struct iov_iter *from)
+{
+    size_t first = min(count, (size_t)(size - pos));
+    size_t copied = copy_from_iter(buffer + pos, first, from);
+
+    if(copied == first && count > first)
+        copied += copy_from_iter(buffer, count - first, from);
+    return copied;
+}
+
+static size_t scull_p_copy_out(struct scull_pipe *dev, unsigned int pos, size_t count,
+                               struct iov_iter *to)
+{
+    return scull_p_ring_copy_out(dev->buffer, dev->buffersize, pos, count, to);
+}
+
+static size_t scull_p_copy_in(struct scull_pipe *dev, unsigned int pos, size_t count,
+                              struct iov_iter *from)
+{
+    return scull_p_ring_copy_in(dev->buffer, dev->buffersize, pos, count, from);
+}
+
+/*
+* record 모드
+* ring에 [u32 length][payload] 형태로 저장, header와 payload 모두 end를 넘어 wrap될 수 있음
+* writer는 record 전체를 쓴 뒤에 wp를 공개하므로 reader는 항상 완전한 record만 봄
+*/
+#define SCULL_P_HDR sizeof(u32)
+
+static void scull_p_peek(struct scull_pipe *dev, unsigned int pos, void *dst, size_t len)
+{
+    size_t first = min(len, (size_t)(dev->buffersize - pos));
+
+    memcpy(dst, dev->buffer + pos, first);
+    memcpy((char *)dst + first, dev->buffer, len - first);
+}
+
+static void scull_p_poke(struct scull_pipe *dev, unsigned int pos, const void *src, size_t len)
+{
+    size_t first = min(len, (size_t)(dev->buffersize - pos));
+
+    memcpy(dev->buffer + pos, src, first);
+    memcpy(dev->buffer, (const char *)src + first, len - first);
+}
+
+/*
+* record 하나를 to로 복사하고 rp 공개
+* 세마포어를 잡은 상태(SPSC 모드면 reader 본인)에서 읽을 데이터가 있을 때 호출
+* 사용자 버퍼가 record보다 작으면 남은 부분은 버림, reclen에 원래 길이 반환
+*/
+static ssize_t scull_p_read_record(struct scull_pipe *dev, struct iov_iter *to, u32 *reclen)
+{
+    unsigned int rp = dev->rp;
+    size_t count;
+    u32 len;
+
+    scull_p_peek(dev, rp, &len, SCULL_P_HDR);
+    count = min_t(size_t, len, iov_iter_count(to));
+    if(scull_p_copy_out(dev, (rp + SCULL_P_HDR) % dev->buffersize, count, to) != count)
+        return -EFAULT;
+
+    smp_store_release(&dev->rp, (rp + SCULL_P_HDR + len) % dev->buffersize);
+    scull_p_sig_arm(dev);
+    *reclen = len;
+    return count;
+}
+
+/*
+* timestamp 모드
+* write 구간(write 한 번, full write 모드는 복사 한 번)마다 [start, end) 바이트 위치와 적재 시각을 side ring에 기록
+* read는 읽은 만큼 out_seq를 늘리며 걸친 구간의 적재 시각을 파일에 남기고
+* 끝까지 읽힌 구간은 ring에 머문 시간을 histogram에 기록한 뒤 side ring에서 뺌
+* side ring이 가득 차면 마지막 구간을 늘려 기록하므로 그 구간은 실제보다 오래 머문 것으로 보임
+* 모두 세마포어를 잡은 상태에서 호출
+*/
+#define SCULL_P_TS_MAX  256     // 2의 거듭제곱
+
+struct scull_p_stamp{
+    u64 start, end;                    // in_seq 기준 바이트 위치
+    u64 ns;                            // 적재 시각 (ktime_get_ns, CLOCK_MONOTONIC)
+};
+
+/* 시작할 때 버퍼에 남아 있는 데이터는 적재 시각 없이 읽힘 */
+static void scull_p_ts_reset(struct scull_pipe *dev)
+{
+    dev->ts_head = dev->ts_tail = 0;
+    dev->out_seq = 0;
+    dev->in_seq = dev->buffer ? scull_p_avail(dev) : 0;
+}
+
+static void scull_p_ts_push(struct scull_pipe *dev, size_t bytes)
+{
+    struct scull_p_stamp *st;
+    u64 start = dev->in_seq;
+
+    dev->in_seq += bytes;
+    if(dev->ts_head - dev->ts_tail == SCULL_P_TS_MAX){
+        dev->stamps[(dev->ts_head - 1) % SCULL_P_TS_MAX].end = dev->in_seq;
+        return;
+    }
+    st = &dev->stamps[dev->ts_head++ % SCULL_P_TS_MAX];
+    st->start = start;
+    st->end = dev->in_seq;
+    st->ns = ktime_get_ns();
+}
+
+/* bytes만큼 읽힌(pf가 NULL이면 overwrite 모드에서 버려진) 데이터의 구간 정리 */
+static void scull_p_ts_consume(struct scull_pipe *dev, struct scull_p_file *pf, size_t bytes)
+{
+    u64 end = dev->out_seq + bytes;
+    u64 now = ktime_get_ns();
+    struct scull_p_stamp *st;
+
+    if(pf){
+        memset(&pf->ts, 0, sizeof(pf->ts));
+        pf->ts.read_ns = now;
+    }
+    while(dev->ts_tail != dev->ts_head){
+        st = &dev->stamps[dev->ts_tail % SCULL_P_TS_MAX];
+        if(st->start >= end)
+            break;
+        if(pf){
+            if(!pf->ts.segments++)
+                pf->ts.first_ns = st->ns;
+            pf->ts.last_ns = st->ns;
+        }
+        // 일부만 읽힌 구간은 남겨둠
+        if(st->end > end)
+            break;
+        if(pf)
+            this_cpu_inc(dev->stats->delay_hist[scull_p_hist_slot(div_u64(now - st->ns, NSEC_PER_USEC))]);
+        dev->ts_tail++;
+    }
+    dev->out_seq = end;
+}
+
+/*
+* overwrite 모드
+* trace ring buffer와 같이 가득 차면 writer를 재우지 않고 rp를 밀어 가장 오래된 데이터를 버림
+* record 모드에서는 record 단위로 버려 reader가 record 중간부터 읽지 않도록 함
+* 버린 양은 lost에 쌓였다가 다음 read가 -EOVERFLOW로 한 번 알림
+* 세마포어를 잡은 writer가 호출, need는 버퍼 크기 - 1 이하
+*/
+static void scull_p_overwrite(struct scull_pipe *dev, size_t need)
+{
+    unsigned int rp = dev->rp;
+    size_t space = spacefree(dev);
+    size_t dropped = 0;
+    u32 len;
+
+    if(space >= need)
+        return;
+
+    if(dev->packet){
+        while(space + dropped < need){
+            scull_p_peek(dev, rp, &len, SCULL_P_HDR);
+            rp = (rp + SCULL_P_HDR + len) % dev->buffersize;
+            dropped += SCULL_P_HDR + len;
+        }
+    }else{
+        dropped = need - space;
+        rp = (rp + dropped) % dev->buffersize;
+    }
+
+    smp_store_release(&dev->rp, rp);
+    dev->overrun += dropped;
+    dev->lost += dropped;
+    if(dev->stamps)
+        scull_p_ts_consume(dev, NULL, dropped);
+}
+
+/* 버린 데이터가 있으면 reader에게 알릴 구간으로 넘기고 -EOVERFLOW, 세마포어를 잡은 상태에서 호출 */
+static int scull_p_check_lost(struct scull_pipe *dev)
+{
+    if(!dev->lost)
+        return 0;
+    dev->lost_last = dev->lost;
+    dev->lost = 0;
+    dev->gaps++;
+    return -EOVERFLOW;
+}
+
+/*
+* 페이지 단위 크기의 버퍼는 vmalloc_user로 할당하여 mmap 가능하게 함
+* vmalloc_user는 0으로 채워주므로 사용자 공간에 이전 내용이 드러나지 않음
+* 해제는 둘 다 kvfree
+*/
+static void *scull_p_kvalloc(size_t size)
+{
+    if(PAGE_ALIGNED(size))
+        return vmalloc_user(size);
+    return kvmalloc(size, GFP_KERNEL);
+}
+
+/*
+* 버퍼 할당 / 해제 helper, 세마포어를 잡은 상태에서 호출
+* 새로 할당한 경우에만 rp, wp 초기화
+*/
+static int scull_p_alloc_buffer(struct scull_pipe *dev)
+{
+    int size;
+
+    if(dev->buffer)
+        return 0;
+
+    size = dev->ringsize ? dev->ringsize : READ_ONCE(scull_p_buffer);
+    if(size < 2)
+        size = SCULL_P_BUFFER;
+    dev->buffer = scull_p_kvalloc(size);
+    if(!dev->buffer)
+        return -ENOMEM;
+    dev->buffersize = size;
+    dev->rp = dev->wp = 0;
+    return 0;
+}
+
+static void scull_p_free_buffer(struct scull_pipe *dev)
+{
+    kvfree(dev->buffer);
+    dev->buffer = NULL;
+    dev->drop = 0;
+    scull_p_ts_reset(dev);
+}
+
+/*
+* fan-out 모드
+* 하나의 ring을 여러 reader가 각자의 위치(pf->rp, pf->seq)로 읽음
+* dev->rp는 가장 뒤처진 reader의 위치로, writer의 빈 공간 계산에만 사용
+*   ├ SCULL_P_FANOUT_BLOCK: 가장 느린 reader가 읽을 때까지 writer가 기다림
+*   └ SCULL_P_FANOUT_LOSSY: writer는 기다리지 않고 오래된 데이터를 덮어씀
+*                           덮어써진 위치를 읽으려는 reader는 -EOVERFLOW를 받고 남은 가장 오래된 데이터로 건너뜀
+* 세마포어를 잡은 상태에서 호출
+*/
+static void scull_p_fan_update(struct scull_pipe *dev)
+{
+    struct scull_p_file *pf;
+    u64 lag = 0;
+    unsigned int avail = scull_p_avail(dev);
+
+    // 남아 있는 데이터보다 더 뒤처진 reader는 이미 덮어써진 것이므로 avail까지만
+    list_for_each_entry(pf, &dev->readers, list)
+        lag = max(lag, dev->wseq - pf->seq);
+    lag = min_t(u64, lag, avail);
+
+    smp_store_release(&dev->rp, (dev->wp + dev->buffersize - (unsigned int)lag) % dev->buffersize);
+}
+
+/* lossy 모드에서 count 바이트를 쓸 공간이 없으면 가장 오래된 데이터를 버림 */
+static void scull_p_fan_drop(struct scull_pipe *dev, size_t count)
+{
+    size_t space = spacefree(dev);
+
+    count = min_t(size_t, count, dev->buffersize - 1);
+    if(count > space)
+        smp_store_release(&dev->rp, (dev->rp + count - space) % dev->buffersize);
+}
+
+/*
+* fan-out read, 세마포어를 잡은 상태에서 호출하고 반환 전에 반납
+*/
+static ssize_t scull_p_fan_read(struct scull_pipe *dev, struct scull_p_file *pf,
+                                struct iov_iter *to, int nonblock)
+{
+    unsigned int avail;
+    size_t count;
+    u64 lag, start;
+    int ret;
+
+    while(!(lag = dev->wseq - pf->seq)){
+        up(&dev->sem);
+        if(nonblock){
+            scull_p_stat_eagain(dev, SCULL_P_RD);
+            return -EAGAIN;
+        }
+        // 모든 reader가 같은 데이터를 읽어야 하므로 exclusive로 대기하지 않음
+        start = ktime_get_ns();
+        ret = wait_event_interruptible(dev->inq, READ_ONCE(dev->wseq) != pf->seq);
+        scull_p_stat_wait(dev, SCULL_P_RD, start);
+        if(ret)
+            return -ERESTARTSYS;
+        if(down_interruptible(&dev->sem))
+            return -ERESTARTSYS;
+    }
+
+    // 읽을 위치가 이미 덮어써진 경우 남아 있는 가장 오래된 데이터로 건너뜀
+    avail = scull_p_avail(dev);
+    if(lag > avail){
+        pf->rp = dev->rp;
+        pf->seq = dev->wseq - avail;
+        up(&dev->sem);
+        return -EOVERFLOW;
+    }
+
+    count = min_t(u64, iov_iter_count(to), lag);
+    count = scull_p_copy_out(dev, pf->rp, count, to);
+    if(!count && iov_iter_count(to)){
+        up(&dev->sem);
+        return -EFAULT;
+    }
+    pf->rp = (pf->rp + count) % dev->buffersize;
+    pf->seq += count;
+    scull_p_fan_update(dev);
+    up(&dev->sem);
+
+    scull_p_stat_xfer(dev, SCULL_P_RD, count);
+    scull_p_read_done(dev);
+    return count;
+}
+
+/*
+* multi-queue 모드
+* 장치의 ring 대신 nqueues개의 sub-ring을 사용, 각 sub-ring은 자신의 세마포어만 잡음
+*   ├ SCULL_P_MQ_CPU: writer는 현재 CPU의 sub-ring에 씀, 순서는 sub-ring 안에서만 보장
+*   └ SCULL_P_MQ_PRODUCER: writer(open)마다 sub-ring 하나를 고정하여 producer별 FIFO 보장
+* reader는 현재 CPU의 sub-ring부터 읽고 비어 있으면 다른 sub-ring에서 가져감 (work stealing)
+* queues 배열은 mq_sem(percpu rwsem)의 read로 보호하므로 data path는 CPU 간 공유 cacheline을 쓰지 않음
+*/
+static unsigned int scull_p_q_avail(struct scull_pipe *dev, struct scull_p_queue *q)
+{
+    return (READ_ONCE(q->wp) + dev->qsize - READ_ONCE(q->rp)) % dev->qsize;
+}
+
+static unsigned int scull_p_q_space(struct scull_pipe *dev, struct scull_p_queue *q)
+{
+    return (READ_ONCE(q->rp) + dev->qsize - READ_ONCE(q->wp) - 1) % dev->qsize;
+}
+
+/* 데이터가 남아 있는 sub-ring이 있는지 확인, mq_sem을 잡은 상태에서 호출 */
+static int scull_p_mq_avail(struct scull_pipe *dev)
+{
+    int i;
+
+    for(i = 0; i < dev->nqueues; i++)
+        if(scull_p_q_avail(dev, dev->queues + i))
+            return 1;
+    return 0;
+}
+
+static struct scull_p_queue *scull_p_mq_pick(struct scull_pipe *dev, struct scull_p_file *pf)
+{
+    if(dev->mq == SCULL_P_MQ_PRODUCER)
+        return dev->queues + pf->queue % dev->nqueues;
+    return dev->queues + raw_smp_processor_id() % dev->nqueues;
+}
+
+static void scull_p_mq_free(struct scull_p_queue *queues, int nqueues)
+{
+    int i;
+
+    if(!queues)
+        return;
+    for(i = 0; i < nqueues; i++)
+        kvfree(queues[i].buffer);
+    kfree(queues);
+}
+
+static struct scull_p_queue *scull_p_mq_alloc(int nqueues, unsigned int qsize)
+{
+    struct scull_p_queue *queues;
+    int i;
+
+    queues = kcalloc(nqueues, sizeof(*queues), GFP_KERNEL);
+    if(!queues)
+        return NULL;
+    for(i = 0; i < nqueues; i++){
+        sema_init(&queues[i].sem, 1);
+        queues[i].buffer = scull_p_kvalloc(qsize);
+        if(!queues[i].buffer){
+            scull_p_mq_free(queues, nqueues);
+            return NULL;
+        }
+    }
+    return queues;
+}
+
+static ssize_t scull_p_mq_read(struct scull_pipe *dev, struct iov_iter *to, int nonblock,
+                               int nowait)
+{
+    struct scull_p_queue *q;
+    unsigned int i, start, rp;
+    ssize_t result = 0;
+    size_t count;
+    u64 t;
+
+    if(!iov_iter_count(to))
+        return 0;
+
+    // IOCB_NOWAIT이면 락에서도 잠들지 않음
+    if(nowait){
+        if(!percpu_down_read_trylock(&dev->mq_sem))
+            return -EAGAIN;
+    }else
+        percpu_down_read(&dev->mq_sem);
+
+    while(READ_ONCE(dev->mq)){
+        // 현재 CPU의 sub-ring부터 돌면서 데이터가 있는 sub-ring을 찾음
+        start = raw_smp_processor_id() % dev->nqueues;
+        for(i = 0; i < dev->nqueues; i++){
+            q = dev->queues + (start + i) % dev->nqueues;
+            if(!scull_p_q_avail(dev, q))
+                continue;
+            if(nowait ? down_trylock(&q->sem) : down_interruptible(&q->sem))
+                continue;
+
+            // 락을 잡는 사이 다른 reader가 가져갔을 수 있으므로 다시 확인
+            rp = q->rp;
+            count = min_t(size_t, iov_iter_count(to), scull_p_q_avail(dev, q));
+            if(count){
+                count = scull_p_ring_copy_out(q->buffer, dev->qsize, rp, count, to);
+                WRITE_ONCE(q->rp, (rp + count) % dev->qsize);
+                result = count ? count : -EFAULT;
+            }
+            up(&q->sem);
+            if(result)
+                goto out;
+        }
+
+        if(nonblock){
+            result = -EAGAIN;
+            goto out;
+        }
+        // 모드가 꺼지면 깨어나서 -EBUSY, 대기 중에도 mq_sem read를 잡고 있으므로 queues는 유지됨
+        t = ktime_get_ns();
+        result = wait_event_interruptible_exclusive(dev->inq,
+                        scull_p_mq_avail(dev) || !READ_ONCE(dev->mq));
+        scull_p_stat_wait(dev, SCULL_P_RD, t);
+        if(result){
+            result = -ERESTARTSYS;
+            goto out;
+        }
+    }
+    result = -EBUSY;
+out:
+    percpu_up_read(&dev->mq_sem);
+    if(result == -EAGAIN)
+        scull_p_stat_eagain(dev, SCULL_P_RD);
+    if(result > 0){
+        scull_p_stat_xfer(dev, SCULL_P_RD, result);
+        if(wq_has_sleeper(&dev->outq))
+            wake_up_interruptible_poll(&dev->outq, SCULL_P_POLLOUT);
+        if(READ_ONCE(dev->sigflags) & SCULL_P_SIGIO_OUT)
+            scull_p_sigio(dev, SCULL_P_SIG_OUT);
+        // 어느 sub-ring이든 남아 있으면 다음 reader를 깨움, 모두 비었으면 edge 모드의 다음 POLL_IN 준비
+        if(scull_p_mq_avail(dev))
+            scull_p_wake_next_reader(dev);
+        else
+            set_bit(SCULL_P_SIG_IN, &dev->sig_armed);
+    }
+    return result;
+}
+
+static ssize_t scull_p_mq_write(struct scull_pipe *dev, struct scull_p_file *pf,
+                                struct iov_iter *from, int nonblock, int nowait)
+{
+    struct scull_p_queue *q;
+    unsigned int wp;
+    ssize_t result;
+    size_t count;
+    u64 start;
+
+    if(!iov_iter_count(from))
+        return 0;
+
+    if(nowait){
+        if(!percpu_down_read_trylock(&dev->mq_sem))
+            return -EAGAIN;
+    }else
+        percpu_down_read(&dev->mq_sem);
+
+    result = -EBUSY;
+    if(!READ_ONCE(dev->mq))
+        goto out;
+
+    q = scull_p_mq_pick(dev, pf);
+    result = -ERESTARTSYS;
+    if(nowait){
+        result = -EAGAIN;
+        if(down_trylock(&q->sem))
+            goto out;
+    }else if(down_interruptible(&q->sem))
+        goto out;
+
+    // 자신의 sub-ring에 빈 공간이 생길 때까지 대기
+    while(!scull_p_q_space(dev, q)){
+        up(&q->sem);
+        result = -EAGAIN;
+        if(nonblock)
+            goto out;
+        // writer마다 기다리는 sub-ring이 다르므로 exclusive로 대기하지 않음
+        start = ktime_get_ns();
+        result = wait_event_interruptible(dev->outq, scull_p_q_space(dev, q) || !READ_ONCE(dev->mq));
+        scull_p_stat_wait(dev, SCULL_P_WR, start);
+        if(result){
+            result = -ERESTARTSYS;
+            goto out;
+        }
+        result = -EBUSY;
+        if(!READ_ONCE(dev->mq))
+            goto out;
+        result = -ERESTARTSYS;
+        if(down_interruptible(&q->sem))
+            goto out;
+    }
+
+    wp = q->wp;
+    count = min_t(size_t, iov_iter_count(from), scull_p_q_space(dev, q));
+    count = scull_p_ring_copy_in(q->buffer, dev->qsize, wp, count, from);
+    WRITE_ONCE(q->wp, (wp + count) % dev->qsize);
+    scull_p_stat_fill(dev, scull_p_q_avail(dev, q));
+    up(&q->sem);
+    result = count ? count : -EFAULT;
+out:
+    percpu_up_read(&dev->mq_sem);
+    if(result == -EAGAIN)
+        scull_p_stat_eagain(dev, SCULL_P_WR);
+    if(result > 0){
+        scull_p_stat_xfer(dev, SCULL_P_WR, result);
+        scull_p_wake_next_reader(dev);
+        if(scull_p_sig_edge(dev, SCULL_P_SIG_IN))
+            scull_p_sigio(dev, SCULL_P_SIG_IN);
+    }
+    return result;
+}
+
+/*
+* multi-queue 모드 변경, 세마포어를 잡은 상태에서 호출
+* 켜는 경우: sub-ring을 할당하고 mq_sem write로 공개
+* 끄는 경우: 먼저 모드를 끄고 대기 중인 reader, writer를 깨운 뒤 mq_sem write로 빠져나가기를 기다려 해제
+*/
+static long scull_p_mq_set(struct scull_pipe *dev, int mode)
+{
+    struct scull_p_queue *queues;
+    unsigned int qsize;
+    int i, nqueues;
+
+    if(mode == dev->mq)
+        return 0;
+
+    if(mode && dev->mq){
+        WRITE_ONCE(dev->mq, mode);
+        return 0;
+    }
+
+    if(mode){
+        if(dev->buffer && dev->rp != dev->wp)
+            return -EBUSY;
+        nqueues = READ_ONCE(scull_p_mq_queues);
+        if(nqueues <= 0)
+            nqueues = num_possible_cpus();
+        /*
+        * sub-ring들이 버퍼 크기를 나눠 가짐
+        * 사용자별 한도는 버퍼 크기로만 계산되므로 sub-ring마다 버퍼 크기만큼 잡으면 한도를 넘어감
+        */
+        nqueues = min3(nqueues, SCULL_P_MQ_MAX, dev->buffersize / 2);
+        qsize = dev->buffersize / nqueues;
+        queues = scull_p_mq_alloc(nqueues, qsize);
+        if(!queues)
+            return -ENOMEM;
+
+        percpu_down_write(&dev->mq_sem);
+        dev->queues = queues;
+        dev->nqueues = nqueues;
+        dev->qsize = qsize;
+        WRITE_ONCE(dev->mq, mode);
+        percpu_up_write(&dev->mq_sem);
+        return 0;
+    }
+
+    for(i = 0; i < dev->nqueues; i++)
+        if(scull_p_q_avail(dev, dev->queues + i))
+            return -EBUSY;
+
+    WRITE_ONCE(dev->mq, SCULL_P_MQ_OFF);
+    wake_up_interruptible_all(&dev->inq);
+    wake_up_interruptible_all(&dev->outq);
+    percpu_down_write(&dev->mq_sem);
+    queues = dev->queues;
+    nqueues = dev->nqueues;
+    dev->queues = NULL;
+    dev->nqueues = 0;
+    percpu_up_write(&dev->mq_sem);
+    scull_p_mq_free(queues, nqueues);
+    return 0;
+}
+
 /* 
 * fasync
-* scull_pipe 장치의 async_queue에 fcntl을 호출한 pid 등록
-* 이후에 SIGIO 전달 시 async_queue에 등록되어있는 모든 프로세스에 전달
+* 파일의 async에 fcntl을 호출한 pid 등록하고 장치의 async_files에 파일 등록
+* 이후에 SIGIO 전달 시 async_files의 파일 중 대상이 되는 파일의 owner에게 전달
 */
 int scull_p_fasync(int fd, struct file *filp, int mode)
 {
-    struct scull_pipe *dev = filp->private_data;
-    return fasync_helper(fd, filp, mode, &dev->async_queue);
+    struct scull_p_file *pf = filp->private_data;
+    struct scull_pipe *dev = pf->dev;
+    int retval;
+
+    retval = fasync_helper(fd, filp, mode, &pf->async);
+    if(retval < 0)
+        return retval;
+
+    spin_lock_irq(&dev->sig_lock);
+    if(pf->async && list_empty(&pf->alist)){
+        list_add_tail(&pf->alist, &dev->async_files);
+        // 새로 등록한 파일이 첫 전이를 놓치지 않도록 edge 준비
+        set_bit(SCULL_P_SIG_IN, &dev->sig_armed);
+        set_bit(SCULL_P_SIG_OUT, &dev->sig_armed);
+    }else if(!pf->async && !list_empty(&pf->alist)){
+        list_del_init(&pf->alist);
+    }
+    spin_unlock_irq(&dev->sig_lock);
+    return retval;
 }
 
 /* 
@@ -50,12 +1083,23 @@ int scull_p_fasync(int fd, struct file *filp, int mode)
 int scull_p_open(struct inode *inode, struct file *filp)
 {
     struct scull_pipe *dev = container_of(inode->i_cdev, struct scull_pipe, cdev);
-    filp->private_data = dev;
+    struct scull_p_file *pf;
+
+    pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+    if(!pf)
+        return -ENOMEM;
+    pf->dev = dev;
+    pf->mode = filp->f_mode;
+    INIT_LIST_HEAD(&pf->list);
+    INIT_LIST_HEAD(&pf->alist);
+    filp->private_data = pf;
 
     /////////////////////////////////////////////////////////////////////
     // critical section                                                //
-    if(down_interruptible(&dev->sem))                                  //
+    if(down_interruptible(&dev->sem)){                                 //
+        kfree(pf);
         return -ERESTARTSYS;                                           
+    }
 
     /*
     * 1. !dev->buffer
@@ -65,34 +1109,50 @@ int scull_p_open(struct inode *inode, struct file *filp)
     *   : kmalloc으로 할당했음에도 NULL인 경우
     *   : 세마포어 락 반납 및 에러 반환 
     */
-    if(!dev->buffer){
-        dev->buffer = kmalloc(scull_p_buffer, GFP_KERNEL);
-        if(!dev->buffer){
-            up(&dev->sem);
-            return -ENOMEM;
-        }
+    /*
+    * SPSC 모드에서는 reader, writer를 각각 하나만 허용
+    * 둘 이상이면 락 없는 data path가 깨지므로 -EBUSY
+    */
+    if(dev->spsc && (((filp->f_mode & FMODE_READ) && dev->nreaders) ||
+                     ((filp->f_mode & FMODE_WRITE) && dev->nwriters))){
+        up(&dev->sem);
+        kfree(pf);
+        return -EBUSY;
     }
 
     /*
-    * scull_pipe 기본 설정
+    * 버퍼를 새로 할당한 경우에만 기본 설정
     * buffersize
-    * buffer, end
     * rp, wp
-    * nreaders, nwriters
+    * 이미 열려 있는 상대편이 쓰고 있거나 persist 모드로 남아 있는 데이터는 초기화하지 않음
     */
-    dev->buffersize = scull_p_buffer;
-    dev->end = dev->buffer + dev->buffersize;
-    dev->rp = dev->wp = dev->buffer;
+    if(scull_p_alloc_buffer(dev)){
+        up(&dev->sem);
+        kfree(pf);
+        return -ENOMEM;
+    }
 
-    if(filp->f_mode & FMODE_READ)
+    /*
+    * nreaders, nwriters
+    * reader는 dev->readers에 등록, fan-out 모드면 지금부터 쓰이는 데이터부터 읽음
+    */
+    if(filp->f_mode & FMODE_READ){
+        pf->rp = dev->wp;
+        pf->seq = dev->wseq;
+        list_add_tail(&pf->list, &dev->readers);
         dev->nreaders++;
-    if(filp->f_mode & FMODE_WRITE)
+    }
+    if(filp->f_mode & FMODE_WRITE){
+        pf->queue = dev->nextq++;
         dev->nwriters++;
+    }
 
     up(&dev->sem);                                                     //
     // critical section                                                //
     /////////////////////////////////////////////////////////////////////
-    
+
+    // io_uring 등에서 IOCB_NOWAIT으로 바로 제출할 수 있음을 알림
+    filp->f_mode |= FMODE_NOWAIT;
     return nonseekable_open(inode, filp);
 }
 
@@ -101,7 +1161,9 @@ int scull_p_open(struct inode *inode, struct file *filp)
 */
 int scull_p_release(struct inode *inode, struct file *filp)
 {
-    struct scull_pipe *dev = filp->private_data;
+    struct scull_p_file *pf = filp->private_data;
+    struct scull_pipe *dev = pf->dev;
+    int i;
 
     /*
     * cleanup fasync
@@ -114,130 +1176,256 @@ int scull_p_release(struct inode *inode, struct file *filp)
     /////////////////////////////////////////////////////////////////////
     // critical section                                                //
     down(&dev->sem);
-    if(filp->f_mode & FMODE_READ)
+    if(filp->f_mode & FMODE_READ){
+        list_del(&pf->list);
         dev->nreaders--;
+        // 가장 느린 reader가 나갔을 수 있으므로 공간 다시 계산
+        if(dev->fanout)
+            scull_p_fan_update(dev);
+    }
     if(filp->f_mode & FMODE_WRITE)
         dev->nwriters--;
-    if(dev->nreaders + dev->nwriters == 0){
-        kfree(dev->buffer);
-        dev->buffer = NULL;
+    // persist 모드면 버퍼와 데이터를 남겨두고 메모리 부족 시 shrinker가 회수
+    if(dev->nreaders + dev->nwriters == 0 && (!dev->persist || dev->drop)){
+        scull_p_free_buffer(dev);
+        // sub-ring은 모드를 끌 때까지 유지하고 데이터만 버림
+        for(i = 0; i < dev->nqueues; i++)
+            dev->queues[i].rp = dev->queues[i].wp = 0;
     }
     up(&dev->sem);
     // critical section                                                //
     /////////////////////////////////////////////////////////////////////
 
+    if(dev->fanout && wq_has_sleeper(&dev->outq))
+        wake_up_interruptible_poll(&dev->outq, SCULL_P_POLLOUT);
+    kfree(pf);
+    return 0;
+}
+
+/* 
+* blocking getreadspace 
+* min(want, rcvlowat) 바이트가 쌓이거나 rcvtimeo가 지날 때까지 대기
+* target이 rcvlowat 이하이므로 깨어난 reader는 항상 읽을 수 있어 exclusive로 대기
+*/
+static int scull_p_getreadspace(struct scull_pipe *dev, int nonblock, int locked, size_t want)
+{
+    unsigned int target = clamp_t(size_t, want, 1, scull_p_rcvlowat(dev));
+    long timeo = READ_ONCE(dev->rcvtimeo);
+    unsigned int avail;
+    int expired = 0;
+    long ret;
+    u64 start;
+
+    if(!timeo)
+        timeo = MAX_SCHEDULE_TIMEOUT;
+
+    /*
+    * target보다 적게 쌓인 경우
+    *   ├ Non-Blocking이거나 timeout이 지났으면 있는 만큼 읽고, 비어 있으면 -EAGAIN
+    *   ├ 세마포어 반납
+    *   ├ dev->inq에 현재 태스크를 넣고 컨디션 만족까지 대기 (target만큼 쌓일 때까지)
+    *   ├ 깨어나면 세마포어 락
+    *   └ 조건 다시 확인
+    */
+    while((avail = scull_p_avail(dev)) < target){
+        if(avail && (nonblock || expired))
+            break;
+        if(locked)
+            up(&dev->sem);
+        if(nonblock || expired){
+            scull_p_stat_eagain(dev, SCULL_P_RD);
+            return -EAGAIN;
+        }
+
+        trace_scull_p_sleep(scull_p_index(dev), false, target, avail);
+        start = ktime_get_ns();
+        ret = scull_p_wait_exclusive_timeout(dev->inq, scull_p_avail(dev) >= target, timeo);
+        scull_p_stat_wait(dev, SCULL_P_RD, start);
+        if(ret < 0)
+            return -ERESTARTSYS;
+        if(timeo != MAX_SCHEDULE_TIMEOUT){
+            timeo = ret;
+            expired = !ret;
+        }
+        if(locked && down_interruptible(&dev->sem))
+            return -ERESTARTSYS;
+    }
+
+    // 읽을 데이터가 있는 경우 0 반환
     return 0;
 }
 
 /*
 * Read
+* read_iter로 구현하여 readv, preadv2, io_uring도 한 번의 호출로 처리
+* IOCB_NOWAIT은 O_NONBLOCK과 같이 취급하여 잠들지 않고 -EAGAIN 반환
 */
-ssize_t scull_p_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+ssize_t scull_p_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
     // 1. 현재 파일 포인터와 연결된 scull_pipe 호출
-    struct scull_pipe *dev = filp->private_data;
+    struct file *filp = iocb->ki_filp;
+    struct scull_pipe *dev = scull_p_dev(filp);
+    size_t count = iov_iter_count(to);
+    int nonblock = (filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    int locked = !READ_ONCE(dev->spsc);   // SPSC 모드면 세마포어 없이 진행
+    int packet = READ_ONCE(dev->packet);
+    struct scull_p_file *pf = filp->private_data;
+    unsigned int rp;
+    ssize_t result;
+    u32 reclen;
+
+    // record 모드에서 크기 0인 read가 record를 소비하지 않도록 함
+    if(packet && !count)
+        return 0;
+
+    // multi-queue 모드는 장치 세마포어 대신 sub-ring별 세마포어 사용
+    if(READ_ONCE(dev->mq))
+        return scull_p_mq_read(dev, to, nonblock, iocb->ki_flags & IOCB_NOWAIT);
 
     /////////////////////////////////////////////////////////////////////
     // critical section                                                //
     // 2. 세마포어 락
-    if(down_interruptible(&dev->sem))
-        return -ERESTARTSYS;
+    if(locked){
+        if(iocb->ki_flags & IOCB_NOWAIT){
+            if(down_trylock(&dev->sem))
+                return -EAGAIN;
+        }else if(down_interruptible(&dev->sem))
+            return -ERESTARTSYS;
+    }
+
+    // mmap된 동안에는 사용자 공간이 ring을 직접 다루므로 read 불가
+    if(locked && scull_p_mapped(dev)){
+        up(&dev->sem);
+        return -EBUSY;
+    }
+
+    // fan-out 모드는 reader마다 자신의 위치에서 읽음, SPSC 모드와 함께 쓸 수 없으므로 항상 locked
+    if(locked && dev->fanout)
+        return scull_p_fan_read(dev, pf, to, nonblock);
 
     /*
     * 3. 현재 버퍼가 비어있는지 확인
-    *   ├ 비어있는 경우
-    *   ├ 세마포어 반납, Non-Blocking 구조면 바로 반환
-    *   ├ dev->inq에 현재 태스크를 넣고 컨디션 만족까지 대기 (rp와 wp가 다를 때까지)
-    *   ├ 깨어나면 세마포어 락
-    *   └ 3번 조건 다시 확인
+    * result = 0: 읽을 데이터 있음
+    * result !=0: 읽을 데이터 없음 -> 반환 (세마포어는 이미 반납됨)
     */
-    while(dev->rp == dev->wp){
+    result = scull_p_getreadspace(dev, nonblock, locked, count);
+    if(result)
+        return result;
+
+    // overwrite 모드에서 읽지 못한 데이터가 버려졌으면 한 번 알리고 다음 read부터 남은 데이터를 읽음
+    if(locked && (result = scull_p_check_lost(dev))){
         up(&dev->sem);
-        if(filp->f_flags & O_NONBLOCK)
-            return -EAGAIN;
+        return result;
+    }
 
-        printk(KERN_NOTICE "\"%s\" reading: Going to sleep\n", current->comm);
-        if(wait_event_interruptible(dev->inq, dev->rp != dev->wp))
-            return -ERESTARTSYS;
-        if(down_interruptible(&dev->sem))
-            return -ERESTARTSYS;
+    // record 모드: record 하나만 읽음
+    if(packet){
+        result = scull_p_read_record(dev, to, &reclen);
+        if(result >= 0 && locked && dev->stamps)
+            scull_p_ts_consume(dev, pf, SCULL_P_HDR + reclen);
+        if(locked)
+            up(&dev->sem);
+        if(result >= 0){
+            scull_p_stat_xfer(dev, SCULL_P_RD, result);
+            trace_scull_p_read(scull_p_index(dev), result, scull_p_avail(dev), dev->buffersize);
+            scull_p_read_done(dev);
+        }
+        return result;
     }
 
     /*
     * 4. read 가능한 count 재계산
     *   ├ --rp--wp--end
-    *   └ --wp--rp--end
+    *   └ --wp--rp--end : end를 넘는 경우도 한 번에 처리
     */
-    if(dev->wp > dev->rp) 
-        count = min(count, (size_t)(dev->wp - dev->rp));
-    else
-        count = min(count, (size_t)(dev->end - dev->rp));
+    rp = dev->rp;
+    count = min(count, (size_t)scull_p_avail(dev));
 
     /*
     * 5. 사용자 공간으로 복사 및 예외처리
+    *   └ 일부만 복사된 경우 복사된 만큼만 읽은 것으로 처리
     */
-    if(copy_to_user(buf, dev->rp, count)){
-        up(&dev->sem);
+    count = scull_p_copy_out(dev, rp, count, to);
+    if(!count && iov_iter_count(to)){
+        if(locked)
+            up(&dev->sem);
         return -EFAULT;
     }
 
     /*
-    * 6. 복사 이후 rp 위치 변경
+    * 6. 복사 이후 rp 위치 공개
     *   └ end까지 읽은 경우 rp위치를 원점으로
     */
-    dev->rp += count;
-    if(dev->rp == dev->end)
-        dev->rp = dev->buffer;
-    up(&dev->sem);
+    smp_store_release(&dev->rp, (rp + count) % dev->buffersize);
+    scull_p_sig_arm(dev);
+    // timestamp 모드: 읽은 데이터의 적재 시각 기록
+    if(locked && dev->stamps)
+        scull_p_ts_consume(dev, pf, count);
+    if(locked)
+        up(&dev->sem);
     // 7. 세마포어 반납
     // critical section                                                //
     /////////////////////////////////////////////////////////////////////
-
-    // 8. 공간이 생겼으니 outq에 대기중인 태스크를 깨움
-    wake_up_interruptible(&dev->outq);
-
-    printk(KERN_NOTICE "\"%s\" did read %li bytes\n", current->comm, (long)count);
-    return count;
-}
-
-/* 
-* spacefree helper
-* 1. dev->rp == dev->wp
-*   : rp = wp인 경우는 버퍼가 비어있는 경우 뿐
-*   : 따라서 buffersize - 1만큼 반환
-* 2. 아닌 경우 남아 있는 만큼 반환 
-*/
-int spacefree(struct scull_pipe *dev)
-{
-    if(dev->rp == dev->wp)
-        return dev->buffersize - 1;
-    return ((dev->rp + dev->buffersize - dev->wp) % dev->buffersize) - 1;
+
+    /*
+    * 8. 공간이 생겼으니 outq에 대기중인 태스크를 깨우고 writer에게 POLL_OUT 전송
+    *   └ sndlowat만큼 비지 않았거나 대기중인 태스크가 없으면 생략
+    * 9. 데이터가 남아 있으면 다음 reader를 깨움
+    */
+    scull_p_read_done(dev);
+
+    scull_p_stat_xfer(dev, SCULL_P_RD, count);
+    trace_scull_p_read(scull_p_index(dev), count, scull_p_avail(dev), dev->buffersize);
+    return count;
 }
 
 /* 
 * blocking getwritespace 
-* 빈 공간이 생길 때까지 대기
+* 빈 공간이 need 바이트 이상 생길 때까지 대기
+* 한 번 잠들면 reader가 sndlowat 이상 비웠을 때만 깨우므로 그 기준으로 대기
+* need가 sndlowat 이하면 깨어났을 때 항상 쓸 수 있으므로 exclusive로 대기
+*   └ 더 큰 record, 원자적 write는 깨어나도 못 쓸 수 있어 다른 writer의 wakeup을 가로채지 않도록 함께 깨어남
 */
-int scull_getwritespace(struct scull_pipe *dev, struct file *filp)
+int scull_getwritespace(struct scull_pipe *dev, struct file *filp, int nonblock, int locked,
+                        size_t need)
 {
+    size_t target = max_t(size_t, need, scull_p_sndlowat(dev));
+    int exclusive = need <= scull_p_sndlowat(dev);
+    int ret;
+    u64 start;
+
     /*
-    * 빈 공간이 없는 경우
+    * 빈 공간이 부족한 경우
     *   ├ 세마포어 반납, Non-Blocking 구조면 바로 반환
     *   ├ dev->outq에 현재 태스크를 넣고 컨디션 만족까지 대기 (빈 공간이 생길 때까지)
     *   ├ 깨어나면 세마포어 락
     *   └ 조건 다시 확인
     */
-    while(spacefree(dev) == 0){
-        up(&dev->sem);
+    while(spacefree(dev) < need){
+        if(locked)
+            up(&dev->sem);
 
-        if(filp->f_flags & O_NONBLOCK)
+        if(nonblock){
+            scull_p_stat_eagain(dev, SCULL_P_WR);
             return -EAGAIN;
+        }
 
-        printk(KERN_NOTICE "\"%s\" writing: Going to sleep\n", current->comm);
-        if(wait_event_interruptible(dev->outq, spacefree(dev) != 0))
+        trace_scull_p_sleep(scull_p_index(dev), true, target, scull_p_avail(dev));
+        start = ktime_get_ns();
+        // 잠든 사이 overwrite 모드가 켜지면 깨어나서 공간을 만듦
+        if(exclusive)
+            ret = wait_event_interruptible_exclusive(dev->outq,
+                        spacefree(dev) >= target || READ_ONCE(dev->overwrite));
+        else
+            ret = wait_event_interruptible(dev->outq,
+                        spacefree(dev) >= target || READ_ONCE(dev->overwrite));
+        scull_p_stat_wait(dev, SCULL_P_WR, start);
+        if(ret)
             return -ERESTARTSYS;
-        if(down_interruptible(&dev->sem))
+        if(locked && down_interruptible(&dev->sem))
             return -ERESTARTSYS;
+        if(locked && dev->overwrite)
+            scull_p_overwrite(dev, need);
     }
 
     // 빈 공간이 있는 경우 0 반환
@@ -246,69 +1434,321 @@ int scull_getwritespace(struct scull_pipe *dev, struct file *filp)
 
 /*
 * Write
+* read와 마찬가지로 write_iter로 구현, IOCB_NOWAIT은 O_NONBLOCK과 같이 취급
+* full write 모드에서는 요청한 count를 모두 쓸 때까지 반복하며
+* scull_p_atomic() 이하의 write는 다른 writer와 섞이지 않도록 한 번에 씀
 */
-ssize_t scull_p_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
+ssize_t scull_p_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
     // 1. 현재 파일 포인터와 연결된 scull_pipe 호출
-    struct scull_pipe *dev = filp->private_data;
+    struct file *filp = iocb->ki_filp;
+    struct scull_pipe *dev = scull_p_dev(filp);
+    size_t count, done = 0;
+    size_t need = 1;
+    int nonblock = (filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    int locked = !READ_ONCE(dev->spsc);   // SPSC 모드면 세마포어 없이 진행
+    int full = READ_ONCE(dev->fullwrite);
+    int packet = READ_ONCE(dev->packet);
+    unsigned int wp;
     int result;
+    u32 reclen = 0;
+
+    // multi-queue 모드는 장치 세마포어 대신 sub-ring별 세마포어 사용
+    if(READ_ONCE(dev->mq))
+        return scull_p_mq_write(dev, filp->private_data, from, nonblock,
+                                iocb->ki_flags & IOCB_NOWAIT);
 
     /////////////////////////////////////////////////////////////////////
     // critical section                                                //
     // 2. 세마포어 락
-    if(down_interruptible(&dev->sem))
-        return -ERESTARTSYS;
+    if(locked){
+        if(iocb->ki_flags & IOCB_NOWAIT){
+            if(down_trylock(&dev->sem))
+                return -EAGAIN;
+        }else if(down_interruptible(&dev->sem))
+            return -ERESTARTSYS;
+    }
+
+    // mmap된 동안에는 사용자 공간이 ring을 직접 다루므로 write 불가
+    if(locked && scull_p_mapped(dev)){
+        up(&dev->sem);
+        return -EBUSY;
+    }
+
+    // 원자적으로 써야 하는 크기면 전체가 들어갈 공간이 생길 때까지 대기
+    if(full && iov_iter_count(from) <= scull_p_atomic(dev))
+        need = max_t(size_t, iov_iter_count(from), 1);
 
     /*
-    * 3. 작성 가능한 공간이 있는지 확인
-    * result = 0: 작성 가능한 공간 있음
-    * result !=0: 작성 가능한 공간 없음 -> 반환
+    * record 모드: header를 포함한 record 전체가 들어갈 공간을 기다려 한 번에 씀
+    *   ├ 크기 0인 write는 record를 만들지 않음
+    *   └ 버퍼에 들어갈 수 없는 record는 -EMSGSIZE
     */
-    result = scull_getwritespace(dev, filp);
-    if(result)
-        return result;
+    if(packet){
+        reclen = iov_iter_count(from);
+        if(!reclen || reclen + SCULL_P_HDR > dev->buffersize - 1){
+            if(locked)
+                up(&dev->sem);
+            return reclen ? -EMSGSIZE : 0;
+        }
+        need = reclen + SCULL_P_HDR;
+    }
+
+    do{
+        /*
+        * 3. 작성 가능한 공간이 있는지 확인
+        * result = 0: 작성 가능한 공간 있음
+        * result !=0: 작성 가능한 공간 없음 -> 반환 (세마포어는 이미 반납됨)
+        *   └ full write 모드에서 이미 일부를 썼다면 쓴 만큼 반환
+        */
+        // lossy fan-out 모드에서는 느린 reader를 기다리지 않고 오래된 데이터를 버림
+        if(locked && dev->fanout == SCULL_P_FANOUT_LOSSY)
+            scull_p_fan_drop(dev, iov_iter_count(from));
+        // overwrite 모드에서도 기다리지 않고 이번에 쓸 만큼 가장 오래된 데이터를 버림
+        else if(locked && dev->overwrite)
+            scull_p_overwrite(dev, packet ? need :
+                              max_t(size_t, need, min_t(size_t, iov_iter_count(from), dev->buffersize - 1)));
+        result = scull_getwritespace(dev, filp, nonblock, locked, need);
+        if(result)
+            return done ? done : result;
+
+        /*
+        * 4. write 가능한 count 재계산
+        *   ├ --rp--wp--end
+        *   └ --wp--rp--end : end를 넘는 경우도 한 번에 처리
+        */
+        wp = dev->wp;
+        if(packet){
+            // payload가 모두 복사된 경우에만 header를 쓰고 wp 공개
+            if(scull_p_copy_in(dev, (wp + SCULL_P_HDR) % dev->buffersize, reclen, from) != reclen){
+                if(locked)
+                    up(&dev->sem);
+                return -EFAULT;
+            }
+            scull_p_poke(dev, wp, &reclen, SCULL_P_HDR);
+            smp_store_release(&dev->wp, (wp + need) % dev->buffersize);
+            scull_p_sig_arm(dev);
+            if(locked && dev->stamps)
+                scull_p_ts_push(dev, need);
+            done = reclen;
+            break;
+        }
+        count = min(iov_iter_count(from), (size_t)spacefree(dev));
+
+        trace_scull_p_accept(scull_p_index(dev), count, scull_p_avail(dev), dev->buffersize);
+        /*
+        * 5. 사용자 공간에서 복사 및 예외처리
+        *   └ 일부만 복사된 경우 복사된 만큼만 쓴 것으로 처리
+        */
+        count = scull_p_copy_in(dev, wp, count, from);
+        if(!count && iov_iter_count(from)){
+            if(locked)
+                up(&dev->sem);
+            return done ? done : -EFAULT;
+        }
+
+        /*
+        * 6. 복사 이후 wp 위치 공개
+        *   └ end까지 작성한 경우 wp위치를 원점으로
+        */
+        smp_store_release(&dev->wp, (wp + count) % dev->buffersize);
+        scull_p_sig_arm(dev);
+        done += count;
+
+        // timestamp 모드: 이번 구간의 적재 시각 기록
+        if(locked && dev->stamps)
+            scull_p_ts_push(dev, count);
+
+        // fan-out 모드면 reader들이 볼 수 있도록 wseq를 늘리고 가장 느린 reader 위치 갱신
+        if(locked && dev->fanout){
+            WRITE_ONCE(dev->wseq, dev->wseq + count);
+            scull_p_fan_update(dev);
+        }
+
+        // full write 모드에서 더 쓸 것이 남았다면 reader를 먼저 깨워 공간을 비우게 함
+        if(full && iov_iter_count(from))
+            scull_p_wake_readers(dev);
+    }while(full && iov_iter_count(from));
+
+    if(locked)
+        up(&dev->sem);
+    // 7. 세마포어 반납
+    // critical section                                                //
+    /////////////////////////////////////////////////////////////////////
 
     /*
-    * 4. write 가능한 count 재계산
-    *   ├ --rp--wp--end
-    *   └ --wp--rp--end
+    * 8. 데이터가 생겼으니 inq에 대기중인 태스크를 깨움
+    * 9. 비동기 알람을 대기 중인 프로세스가 있는 경우 SIGIO 전송
+    * rcvlowat만큼 쌓이지 않았거나 대기중인 태스크가 없으면 생략
     */
-    count = min(count, (size_t)spacefree(dev));
-    if(dev->wp >= dev->rp)
-        count = min(count, (size_t)(dev->end - dev->wp));
-    else
-        count = min(count, (size_t)(dev->rp - dev->wp -1));
+    scull_p_wake_readers(dev);
+    // 10. 공간이 남아 있으면 다음 writer를 깨움
+    scull_p_wake_writers(dev);
+
+    scull_p_stat_xfer(dev, SCULL_P_WR, done);
+    scull_p_stat_fill(dev, scull_p_avail(dev));
+    trace_scull_p_write(scull_p_index(dev), done, scull_p_avail(dev), dev->buffersize);
+    return done;
+}
+
+/*
+* mmap ring
+* offset 0: control page (struct scull_p_ring_ctrl), 그 다음 페이지부터 buffersize 바이트의 ring
+* 매핑된 동안 rp, wp는 control page의 tail, head가 가지고 있으며 read/write는 -EBUSY
+* producer와 consumer는 syscall 없이 데이터를 쓰고 head/tail만 release로 공개
+* 비어 있다가 채워졌거나(SCULL_P_RING_IN) 가득 찼다가 비워진(SCULL_P_RING_OUT) 경우에만
+* SCULL_P_IOCRINGWAKE로 poll, SIGIO 대기자를 깨움
+* 마지막 매핑이 해제되면 head, tail을 다시 rp, wp로 가져옴
+*
+* mmap, munmap은 mmap_lock을 잡은 채로 들어오고, read/write는 dev->sem을 잡은 채로
+* 사용자 버퍼에 복사하다 fault가 나면 mmap_lock을 기다린다.
+* 그래서 vma 콜백은 dev->sem을 기다리지 않고 ring_lock으로만 rp, wp를 인계한다.
+*/
+static void scull_p_vma_open(struct vm_area_struct *vma)
+{
+    struct scull_pipe *dev = vma->vm_private_data;
+
+    spin_lock(&dev->ring_lock);
+    atomic_inc(&dev->vmas);
+    spin_unlock(&dev->ring_lock);
+}
+
+static void scull_p_vma_close(struct vm_area_struct *vma)
+{
+    struct scull_pipe *dev = vma->vm_private_data;
+    u32 head, tail;
 
-    printk(KERN_NOTICE "Going to accept %li bytes to %p from %p\n", (long)count, dev->wp, buf);
     /*
-    * 5. 사용자 공간으로 복사 및 예외처리
+    * 매핑이 남아 있는 동안에는 data path와 ioctl이 rp, wp를 건드리지 않으므로
+    * 마지막 매핑이면 vmas를 내리기 전에 rp, wp를 되돌려 놓고 release로 공개
     */
-    if(copy_from_user(dev->wp, buf, count)){
-        up(&dev->sem);
-        return -EFAULT;
+    spin_lock(&dev->ring_lock);
+    if(atomic_read(&dev->vmas) == 1){
+        // 사용자 공간이 망가뜨린 위치는 믿지 않고 버퍼를 비움
+        head = READ_ONCE(dev->ring->head);
+        tail = READ_ONCE(dev->ring->tail);
+        if(head >= dev->buffersize || tail >= dev->buffersize)
+            head = tail = 0;
+        dev->wp = head;
+        dev->rp = tail;
     }
-    
+    atomic_dec_return_release(&dev->vmas);
+    spin_unlock(&dev->ring_lock);
+
+    wake_up_interruptible_all(&dev->inq);
+    wake_up_interruptible_all(&dev->outq);
+}
+
+static vm_fault_t scull_p_vma_fault(struct vm_fault *vmf)
+{
+    struct scull_pipe *dev = vmf->vma->vm_private_data;
+    unsigned long offset = (vmf->pgoff - 1) << PAGE_SHIFT;
+
+    // 매핑된 동안에는 버퍼가 바뀌지 않으므로 락 없이 페이지를 찾음
+    if(vmf->pgoff == 0)
+        vmf->page = virt_to_page(dev->ring);
+    else if(offset < dev->buffersize)
+        vmf->page = vmalloc_to_page(dev->buffer + offset);
+    else
+        return VM_FAULT_SIGBUS;
+
+    get_page(vmf->page);
+    return 0;
+}
+
+static const struct vm_operations_struct scull_p_vm_ops = {
+    .open  = scull_p_vma_open,
+    .close = scull_p_vma_close,
+    .fault = scull_p_vma_fault,
+};
+
+int scull_p_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct scull_pipe *dev = scull_p_dev(filp);
+    unsigned long len = vma->vm_end - vma->vm_start;
+    int retval = 0;
+
+    // 두 프로세스가 같은 ring을 봐야 하므로 공유 매핑만 허용
+    if(vma->vm_pgoff || !(vma->vm_flags & VM_SHARED))
+        return -EINVAL;
+    /*
+    * 세마포어를 가진 쪽이 사용자 버퍼 fault로 이 mmap_lock을 기다리고 있을 수 있으므로
+    * 기다리지 않고, 다른 read/write/ioctl이 진행 중이면 -EAGAIN
+    */
+    if(down_trylock(&dev->sem))
+        return -EAGAIN;
+
     /*
-    * 6. 복사 이후 wp 위치 변경
-    *   └ end까지 작성한 경우 wp위치를 원점으로
+    * 1. SPSC 모드는 세마포어 밖에서 rp, wp를 바꾸므로, fan-out 모드는 reader별 위치가 있으므로 -EBUSY
+    * 2. record 모드는 커널이 record header를 믿어야 하므로 -EINVAL
+    * 3. vmalloc_user로 할당된 페이지 단위 버퍼만, control page를 포함한 전체 크기로만 매핑
     */
-    dev->wp += count;
-    if(dev->wp == dev->end)
-        dev->wp = dev->buffer;
+    if(dev->spsc || dev->fanout || dev->mq || dev->stamps)
+        retval = -EBUSY;
+    else if(dev->packet || !is_vmalloc_addr(dev->buffer) ||
+            len != PAGE_SIZE + dev->buffersize)
+        retval = -EINVAL;
+    else if(!dev->ring && !(dev->ring = (void *)get_zeroed_page(GFP_KERNEL)))
+        retval = -ENOMEM;
+    if(retval)
+        goto out;
+
+    vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+    vma->vm_ops = &scull_p_vm_ops;
+    vma->vm_private_data = dev;
+
+    // 첫 매핑이면 현재 rp, wp를 control page로 넘김, 동시에 진행 중인 munmap과는 ring_lock으로 순서를 정함
+    spin_lock(&dev->ring_lock);
+    if(!atomic_read(&dev->vmas)){
+        dev->ring->size = dev->buffersize;
+        WRITE_ONCE(dev->ring->head, dev->wp);
+        WRITE_ONCE(dev->ring->tail, dev->rp);
+    }
+    atomic_inc(&dev->vmas);
+    spin_unlock(&dev->ring_lock);
+out:
     up(&dev->sem);
-    // 7. 세마포어 반납
-    // critical section                                                //
-    /////////////////////////////////////////////////////////////////////
+    return retval;
+}
+
+/* 매핑된 동안의 poll, 사용자 공간이 쓴 head, tail이 범위를 벗어나면 POLLERR */
+static unsigned int scull_p_ring_poll(struct scull_pipe *dev)
+{
+    u32 size = dev->buffersize;
+    u32 head, tail;
+    unsigned int mask = 0;
 
-    // 8. 데이터가 생겼으니 inq에 대기중인 태스크를 깨움
-    wake_up_interruptible(&dev->inq);
+    /*
+    * poll_wait로 대기 큐에 들어간 뒤 head, tail을 읽도록 순서를 보장
+    * 상대편은 head/tail 공개 후 상태 전이를 확인하므로 wakeup을 놓치지 않음
+    */
+    smp_mb();
+    head = smp_load_acquire(&dev->ring->head);
+    tail = smp_load_acquire(&dev->ring->tail);
 
-    // 9. 비동기 알람을 대기 중인 프로세스가 있는 경우 SIGIO 전송
-    if(dev->async_queue)
-        kill_fasync(&dev->async_queue, SIGIO, POLL_IN);
+    if(head >= size || tail >= size)
+        return POLLERR;
+    if(head != tail)
+        mask |= POLLIN | POLLRDNORM;
+    if((tail + size - head - 1) % size)
+        mask |= POLLOUT | POLLWRNORM;
+    return mask;
+}
 
-    printk(KERN_NOTICE "\"%s\" did write %li bytes\n", current->comm, (long)count);
-    return count;
+/* multi-queue 모드의 poll, 읽을 sub-ring이 하나라도 있거나 자신이 쓸 sub-ring에 공간이 있는지 확인 */
+static unsigned int scull_p_mq_poll(struct scull_pipe *dev, struct scull_p_file *pf)
+{
+    unsigned int mask = 0;
+
+    percpu_down_read(&dev->mq_sem);
+    if(dev->mq){
+        if(scull_p_mq_avail(dev))
+            mask |= POLLIN | POLLRDNORM;
+        if(scull_p_q_space(dev, scull_p_mq_pick(dev, pf)))
+            mask |= POLLOUT | POLLWRNORM;
+    }
+    percpu_up_read(&dev->mq_sem);
+    return mask;
 }
 
 /* 
@@ -323,25 +1763,642 @@ ssize_t scull_p_write(struct file *filp, const char __user *buf, size_t count, l
 */
 unsigned int scull_p_poll(struct file *filp, poll_table *wait)
 {
-    struct scull_pipe *dev = filp->private_data;
+    struct scull_p_file *pf = filp->private_data;
+    struct scull_pipe *dev = pf->dev;
     unsigned int mask = 0;
-    down(&dev->sem);
-    poll_wait(filp, &dev->inq, wait);
-    poll_wait(filp, &dev->outq, wait);
-    if(dev->rp != dev->wp)
+
+    __poll_t events = poll_requested_events(wait);
+
+    // 요청한 이벤트의 대기 큐에만 들어가 관심 없는 쪽의 wakeup은 받지 않음
+    if(events & SCULL_P_POLLIN)
+        poll_wait(filp, &dev->inq, wait);
+    if(events & SCULL_P_POLLOUT)
+        poll_wait(filp, &dev->outq, wait);
+    // rp, wp는 acquire로 읽으므로 세마포어 없이 확인
+    if(scull_p_mapped(dev))
+        return scull_p_ring_poll(dev);
+    if(READ_ONCE(dev->mq))
+        return scull_p_mq_poll(dev, pf);
+    // 일반 모드는 rcvlowat, sndlowat 기준으로 알림
+    if(READ_ONCE(dev->fanout) ? READ_ONCE(dev->wseq) != pf->seq :
+                                scull_p_avail(dev) >= scull_p_rcvlowat(dev))
         mask |= POLLIN | POLLRDNORM;
-    if(spacefree(dev))
+    // overwrite 모드의 writer는 기다리지 않으므로 항상 쓸 수 있음
+    if(READ_ONCE(dev->overwrite) || spacefree(dev) >= scull_p_sndlowat(dev))
         mask |= POLLOUT | POLLWRNORM;
-    up(&dev->sem);
     return mask;
 }
 
+/*
+* 버퍼 크기 변경 (F_SETPIPE_SZ와 같은 역할)
+* 1. 일반 사용자는 scull_p_max_size, 사용자별 합계 scull_p_user_max로 제한 -> -EPERM
+* 2. 새 버퍼를 할당하고 남아 있는 데이터를 rp부터 순서대로 옮김
+*   └ 남은 데이터가 새 크기에 들어가지 않으면 -EBUSY
+* 3. SPSC 모드에서는 data path가 세마포어 없이 buffer를 쓰므로 -EBUSY, mmap된 동안에도 -EBUSY
+* 지정한 크기는 장치에 남아 다음 버퍼 할당에도 사용
+*/
+static DEFINE_MUTEX(scull_p_size_lock);    // 장치들의 ringsize, owner 보호
+
+static long scull_p_user_usage(kuid_t uid, struct scull_pipe *except)
+{
+    long usage = 0;
+    int i;
+
+    for(i = 0; i < scull_p_nr_devs; i++){
+        struct scull_pipe *dev = scull_p_devices + i;
+
+        if(dev != except && dev->ringsize && uid_eq(dev->owner, uid))
+            usage += dev->ringsize;
+    }
+    return usage;
+}
+
+static long scull_p_resize(struct scull_pipe *dev, unsigned long size)
+{
+    unsigned int avail, first;
+    char *buffer;
+    long retval = size;
+
+    if(size < 2 || size > INT_MAX)
+        return -EINVAL;
+
+    mutex_lock(&scull_p_size_lock);
+    if(!capable(CAP_SYS_RESOURCE) &&
+       (size > scull_p_max_size ||
+        scull_p_user_usage(current_uid(), dev) + size > scull_p_user_max)){
+        retval = -EPERM;
+        goto out;
+    }
+
+    buffer = scull_p_kvalloc(size);
+    if(!buffer){
+        retval = -ENOMEM;
+        goto out;
+    }
+
+    if(down_interruptible(&dev->sem)){
+        kvfree(buffer);
+        retval = -ERESTARTSYS;
+        goto out;
+    }
+    if(dev->spsc || dev->fanout || dev->mq || scull_p_mapped(dev)){
+        retval = -EBUSY;
+    }else if(dev->buffer){
+        avail = scull_p_avail(dev);
+        if(avail >= size){
+            retval = -EBUSY;
+        }else{
+            // 남은 데이터를 새 버퍼의 처음부터 이어 붙임
+            first = min(avail, (unsigned int)(dev->buffersize - dev->rp));
+            memcpy(buffer, dev->buffer + dev->rp, first);
+            memcpy(buffer + first, dev->buffer, avail - first);
+            kvfree(dev->buffer);
+            dev->buffer = buffer;
+            dev->buffersize = size;
+            dev->rp = 0;
+            dev->wp = avail;
+            buffer = NULL;
+        }
+    }
+    if(retval > 0){
+        dev->ringsize = size;
+        dev->owner = current_uid();
+    }
+    up(&dev->sem);
+    kvfree(buffer);
+
+    // 빈 공간이 늘었을 수 있으므로 writer를 깨움
+    if(retval > 0)
+        wake_up_interruptible_all(&dev->outq);
+out:
+    mutex_unlock(&scull_p_size_lock);
+    return retval;
+}
+
+/*
+* shrinker
+* persist 모드로 남아 있는 버퍼 중 열린 파일이 없고 비어 있는 버퍼만 회수
+* 읽지 않은 데이터가 남아 있는 버퍼는 회수하지 않음
+* 회수 단위는 페이지
+*/
+static struct shrinker *scull_p_shrinker;
+
+static int scull_p_reclaimable(struct scull_pipe *dev)
+{
+    return dev->buffer && dev->nreaders + dev->nwriters == 0 && dev->rp == dev->wp;
+}
+
+static unsigned long scull_p_shrink_count(struct shrinker *shrink, struct shrink_control *sc)
+{
+    unsigned long pages = 0;
+    int i;
+
+    // 대략적인 값이면 충분하므로 세마포어 없이 확인
+    for(i = 0; i < scull_p_nr_devs; i++){
+        struct scull_pipe *dev = scull_p_devices + i;
+
+        if(data_race(scull_p_reclaimable(dev)))
+            pages += DIV_ROUND_UP(data_race(dev->buffersize), PAGE_SIZE);
+    }
+    return pages ? pages : SHRINK_EMPTY;
+}
+
+static unsigned long scull_p_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
+{
+    unsigned long freed = 0;
+    int i;
+
+    for(i = 0; i < scull_p_nr_devs && freed < sc->nr_to_scan; i++){
+        struct scull_pipe *dev = scull_p_devices + i;
+
+        if(down_trylock(&dev->sem))
+            continue;
+        if(scull_p_reclaimable(dev)){
+            freed += DIV_ROUND_UP(dev->buffersize, PAGE_SIZE);
+            scull_p_free_buffer(dev);
+        }
+        up(&dev->sem);
+    }
+    return freed ? freed : SHRINK_STOP;
+}
+
+/*
+* recvmmsg와 같은 batch read
+* 첫 record만 기다리고(Non-Blocking이면 -EAGAIN) 이후에는 남아 있는 record를 vlen개까지 가져감
+* 각 msg에 복사한 크기(msg_len)와 원래 record 크기(rec_len)를 기록하고 가져간 record 수 반환
+*/
+static long scull_p_recvmmsg(struct file *filp, struct scull_p_mmsg __user *umm)
+{
+    struct scull_pipe *dev = scull_p_dev(filp);
+    struct scull_p_msg __user *umsg;
+    struct scull_p_mmsg mm;
+    struct scull_p_msg msg;
+    struct iov_iter iter;
+    int nonblock = filp->f_flags & O_NONBLOCK;
+    int locked = !READ_ONCE(dev->spsc);
+    unsigned int i;
+    ssize_t n = 0;
+    u32 reclen;
+
+    if(copy_from_user(&mm, umm, sizeof(mm)))
+        return -EFAULT;
+    if(!READ_ONCE(dev->packet))
+        return -EINVAL;
+    if(!mm.vlen)
+        return 0;
+    mm.vlen = min_t(u32, mm.vlen, UIO_MAXIOV);
+    umsg = u64_to_user_ptr(mm.msgs);
+
+    if(locked && down_interruptible(&dev->sem))
+        return -ERESTARTSYS;
+    if(locked && scull_p_mapped(dev)){
+        up(&dev->sem);
+        return -EBUSY;
+    }
+    n = scull_p_getreadspace(dev, nonblock, locked, SIZE_MAX);
+    if(n)
+        return n;
+    if(locked && (n = scull_p_check_lost(dev))){
+        up(&dev->sem);
+        return n;
+    }
+
+    for(i = 0; i < mm.vlen && scull_p_avail(dev); i++){
+        if(copy_from_user(&msg, umsg + i, sizeof(msg))){
+            n = -EFAULT;
+            break;
+        }
+        n = import_ubuf(ITER_DEST, u64_to_user_ptr(msg.buf), msg.len, &iter);
+        if(!n)
+            n = scull_p_read_record(dev, &iter, &reclen);
+        if(n < 0)
+            break;
+        // SCULL_P_IOCGTSTAMP는 마지막 record의 적재 시각을 반환
+        if(locked && dev->stamps)
+            scull_p_ts_consume(dev, filp->private_data, SCULL_P_HDR + reclen);
+
+        // record는 이미 소비되었으므로 결과 기록에 실패해도 개수에 포함
+        scull_p_stat_xfer(dev, SCULL_P_RD, n);
+        msg.msg_len = n;
+        msg.rec_len = reclen;
+        if(copy_to_user(umsg + i, &msg, sizeof(msg))){
+            n = -EFAULT;
+            i++;
+            break;
+        }
+    }
+    if(locked)
+        up(&dev->sem);
+
+    if(i)
+        scull_p_read_done(dev);
+    return i ? i : n;
+}
+
+/*
+* ioctl
+* SCULL_P_IOCSWMARK: watermark 설정 (struct scull_p_wmark)
+* SCULL_P_IOCGWMARK: 현재 watermark 반환
+* SCULL_P_IOCTTSTAMP: timestamp 모드 설정 (0 / 1)
+* SCULL_P_IOCQTSTAMP: 현재 timestamp 모드 반환
+* SCULL_P_IOCGTSTAMP: 마지막 read가 읽은 데이터의 적재 시각 (struct scull_p_tstamp)
+* SCULL_P_IOCRSTATS: /proc/scullpipe 통계 초기화
+* SCULL_P_IOCSSIGIO: SIGIO 전송 방식 설정 (struct scull_p_sigio)
+* SCULL_P_IOCGSIGIO: 현재 SIGIO 전송 방식 반환
+* SCULL_P_IOCTOVERWRITE: overwrite 모드 설정 (0 / 1)
+* SCULL_P_IOCQOVERWRITE: 현재 overwrite 모드 반환
+* SCULL_P_IOCGOVERRUN: overwrite 모드에서 버린 데이터 통계 (struct scull_p_overrun)
+* SCULL_P_IOCTMQ: multi-queue 모드 설정 (SCULL_P_MQ_OFF / CPU / PRODUCER)
+* SCULL_P_IOCQMQ: 현재 multi-queue 모드 반환
+* SCULL_P_IOCTFANOUT: fan-out 모드 설정 (SCULL_P_FANOUT_OFF / BLOCK / LOSSY)
+* SCULL_P_IOCQFANOUT: 현재 fan-out 모드 반환
+* SCULL_P_IOCTPACKET: record 모드 설정 (arg 0 / 1), 버퍼가 비어 있을 때만 가능
+* SCULL_P_IOCQPACKET: 현재 record 모드 반환
+* SCULL_P_IOCRECVMMSG: record 여러 개를 한 번에 읽음
+* SCULL_P_IOCRINGWAKE: mmap ring의 상태 전이를 알림 (SCULL_P_RING_IN / SCULL_P_RING_OUT)
+* SCULL_P_IOCTPERSIST: persist 모드 설정 (arg 0 / 1)
+* SCULL_P_IOCQPERSIST: 현재 persist 모드 반환
+* SCULL_P_IOCDROP: 남아 있는 데이터를 버리고 마지막 close 때 버퍼 해제
+* SCULL_P_IOCTSIZE: 버퍼 크기 변경 (arg 바이트), 변경된 크기 반환
+* SCULL_P_IOCQSIZE: 현재 버퍼 크기 반환
+* SCULL_P_IOCTSPSC: SPSC 모드 설정 (arg 0 / 1)
+*   └ 이미 reader나 writer가 둘 이상 열려 있으면 -EBUSY
+* SCULL_P_IOCQSPSC: 현재 SPSC 모드 반환
+* SCULL_P_IOCTFULL: full write 모드 설정 (arg 0 / 1)
+* SCULL_P_IOCQFULL: 현재 full write 모드 반환
+*/
+long scull_p_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct scull_pipe *dev = scull_p_dev(filp);
+    struct scull_p_wmark wm;
+    struct scull_p_overrun ov;
+    struct scull_p_sigio sg;
+    struct scull_p_tstamp ts;
+    long retval = 0;
+    int cpu;
+
+    if(_IOC_TYPE(cmd) != SCULL_IOC_MAGIC) return -ENOTTY;
+    if(_IOC_NR(cmd) > SCULL_IOC_MAXNR) return -ENOTTY;
+
+    switch(cmd){
+        case SCULL_P_IOCSWMARK:
+            if(copy_from_user(&wm, (void __user *)arg, sizeof(wm)))
+                return -EFAULT;
+            if(!wm.rcvlowat || !wm.sndlowat || wm.rcvlowat > INT_MAX || wm.sndlowat > INT_MAX)
+                return -EINVAL;
+            WRITE_ONCE(dev->rcvlowat, wm.rcvlowat);
+            WRITE_ONCE(dev->sndlowat, wm.sndlowat);
+            WRITE_ONCE(dev->rcvtimeo, msecs_to_jiffies(wm.rcvtimeo_ms));
+            // 기준이 낮아졌을 수 있으므로 대기 중인 태스크가 모두 다시 확인하도록 깨움
+            wake_up_interruptible_all(&dev->inq);
+            wake_up_interruptible_all(&dev->outq);
+            break;
+
+        case SCULL_P_IOCGWMARK:
+            memset(&wm, 0, sizeof(wm));
+            wm.rcvlowat = READ_ONCE(dev->rcvlowat);
+            wm.sndlowat = READ_ONCE(dev->sndlowat);
+            wm.rcvtimeo_ms = jiffies_to_msecs(READ_ONCE(dev->rcvtimeo));
+            if(copy_to_user((void __user *)arg, &wm, sizeof(wm)))
+                return -EFAULT;
+            break;
+
+        case SCULL_P_IOCTTSTAMP:
+            if(down_interruptible(&dev->sem))
+                return -ERESTARTSYS;
+            // data path가 세마포어를 잡고 side ring을 다룰 수 있는 모드에서만 사용
+            if(arg && (dev->spsc || dev->fanout || dev->mq || scull_p_mapped(dev))){
+                retval = -EBUSY;
+            }else if(arg && !dev->stamps){
+                dev->stamps = kmalloc_array(SCULL_P_TS_MAX, sizeof(struct scull_p_stamp), GFP_KERNEL);
+                if(dev->stamps)
+                    scull_p_ts_reset(dev);
+                else
+                    retval = -ENOMEM;
+            }else if(!arg){
+                kfree(dev->stamps);
+                dev->stamps = NULL;
+            }
+            up(&dev->sem);
+            break;
+
+        case SCULL_P_IOCQTSTAMP:
+            return !!READ_ONCE(dev->stamps);
+
+        case SCULL_P_IOCGTSTAMP:
+            if(down_interruptible(&dev->sem))
+                return -ERESTARTSYS;
+            ts = ((struct scull_p_file *)filp->private_data)->ts;
+            up(&dev->sem);
+            if(copy_to_user((void __user *)arg, &ts, sizeof(ts)))
+                return -EFAULT;
+            break;
+
+        case SCULL_P_IOCRSTATS:
+            // 장치를 쓰는 모든 사용자의 통계이므로 관리자만 초기화
+            if(!capable(CAP_SYS_ADMIN))
+                return -EPERM;
+            // 다른 CPU가 올리는 중인 값은 일부 남을 수 있음
+            for_each_possible_cpu(cpu)
+                memset(per_cpu_ptr(dev->stats, cpu), 0, sizeof(struct scull_p_stats));
+            break;
+
+        case SCULL_P_IOCSSIGIO:
+            if(copy_from_user(&sg, (void __user *)arg, sizeof(sg)))
+                return -EFAULT;
+            if(sg.flags & ~(SCULL_P_SIGIO_EDGE | SCULL_P_SIGIO_OUT | SCULL_P_SIGIO_ONE))
+                return -EINVAL;
+            spin_lock_irq(&dev->sig_lock);
+            dev->sigflags = sg.flags;
+            dev->sig_interval = msecs_to_jiffies(sg.interval_ms);
+            dev->sig_next = jiffies;
+            set_bit(SCULL_P_SIG_IN, &dev->sig_armed);
+            set_bit(SCULL_P_SIG_OUT, &dev->sig_armed);
+            spin_unlock_irq(&dev->sig_lock);
+            break;
+
+        case SCULL_P_IOCGSIGIO:
+            memset(&sg, 0, sizeof(sg));
+            spin_lock_irq(&dev->sig_lock);
+            sg.flags = dev->sigflags;
+            sg.interval_ms = jiffies_to_msecs(dev->sig_interval);
+            spin_unlock_irq(&dev->sig_lock);
+            if(copy_to_user((void __user *)arg, &sg, sizeof(sg)))
+                return -EFAULT;
+            break;
+
+        case SCULL_P_IOCTOVERWRITE:
+            if(down_interruptible(&dev->sem))
+                return -ERESTARTSYS;
+            // rp를 writer가 옮기므로 세마포어 없이 읽는 SPSC, reader별 위치를 가진 fan-out, multi-queue와 함께 쓸 수 없음
+            if(arg && (dev->spsc || dev->fanout || dev->mq))
+                retval = -EBUSY;
+            else
+                WRITE_ONCE(dev->overwrite, !!arg);
+            up(&dev->sem);
+            // 공간을 기다리던 writer를 깨워 오래된 데이터를 버리고 쓰게 함
+            if(!retval && arg)
+                wake_up_interruptible_all(&dev->outq);
+            break;
+
+        case SCULL_P_IOCQOVERWRITE:
+            return READ_ONCE(dev->overwrite);
+
+        case SCULL_P_IOCGOVERRUN:
+            memset(&ov, 0, sizeof(ov));
+            if(down_interruptible(&dev->sem))
+                return -ERESTARTSYS;
+            ov.overrun = dev->overrun;
+            ov.lost = dev->lost_last;
+            ov.pending = dev->lost;
+            ov.gaps = dev->gaps;
+            up(&dev->sem);
+            if(copy_to_user((void __user *)arg, &ov, sizeof(ov)))
+                return -EFAULT;
+            break;
+
+        case SCULL_P_IOCTMQ:
+            if(arg > SCULL_P_MQ_PRODUCER)
+                return -EINVAL;
+            if(down_interruptible(&dev->sem))
+                return -ERESTARTSYS;
+            /*
+            * 장치를 연 파일이 자신뿐일 때만 변경
+            * 다른 파일의 reader, writer가 이전 모드의 ring에서 기다리고 있지 않도록 함
+            */
+            if(dev->nreaders + dev->nwriters > 1 || dev->spsc || dev->packet ||
+               dev->fanout || dev->overwrite || dev->stamps || scull_p_mapped(dev))
+                retval = -EBUSY;
+            else
+                retval = scull_p_mq_set(dev, arg);
+            up(&dev->sem);
+            break;
+
+        case SCULL_P_IOCQMQ:
+            return READ_ONCE(dev->mq);
+
+        case SCULL_P_IOCTFANOUT:
+            if(arg > SCULL_P_FANOUT_LOSSY)
+                return -EINVAL;
+            if(down_interruptible(&dev->sem))
+                return -ERESTARTSYS;
+            if(dev->spsc || dev->packet || dev->mq || dev->overwrite || dev->stamps ||
+               scull_p_mapped(dev)){
+                retval = -EBUSY;
+            }else{
+                // 새로 켜는 경우 모든 reader가 남아 있는 데이터부터 읽도록 위치 설정
+                if(arg && !dev->fanout){
+                    struct scull_p_file *pf;
+                    unsigned int avail = scull_p_avail(dev);
+
+                    list_for_each_entry(pf, &dev->readers, list){
+                        pf->rp = dev->rp;
+                        pf->seq = dev->wseq - avail;
+                    }
+                }
+                WRITE_ONCE(dev->fanout, arg);
+            }
+            up(&dev->sem);
+            wake_up_interruptible_all(&dev->inq);
+            break;
+
+        case SCULL_P_IOCQFANOUT:
+            return READ_ONCE(dev->fanout);
+
+        case SCULL_P_IOCTPACKET:
+            if(down_interruptible(&dev->sem))
+                return -ERESTARTSYS;
+            // 버퍼에 남은 데이터의 형식이 바뀌지 않도록 비어 있을 때만 변경
+            if(dev->spsc || dev->fanout || dev->mq || scull_p_mapped(dev) ||
+               (dev->buffer && dev->rp != dev->wp))
+                retval = -EBUSY;
+            else
+                WRITE_ONCE(dev->packet, !!arg);
+            up(&dev->sem);
+            break;
+
+        case SCULL_P_IOCQPACKET:
+            return READ_ONCE(dev->packet);
+
+        case SCULL_P_IOCRINGWAKE:
+            if(!scull_p_mapped(dev))
+                return -EINVAL;
+            // 사용자 공간이 상태 전이에만 부르므로 edge 확인 없이 전송
+            if(arg & SCULL_P_RING_IN){
+                wake_up_interruptible_poll(&dev->inq, SCULL_P_POLLIN);
+                scull_p_sigio(dev, SCULL_P_SIG_IN);
+            }
+            if(arg & SCULL_P_RING_OUT){
+                wake_up_interruptible_poll(&dev->outq, SCULL_P_POLLOUT);
+                scull_p_sigio(dev, SCULL_P_SIG_OUT);
+            }
+            break;
+
+        case SCULL_P_IOCRECVMMSG:
+            return scull_p_recvmmsg(filp, (struct scull_p_mmsg __user *)arg);
+
+        case SCULL_P_IOCTPERSIST:
+            if(down_interruptible(&dev->sem))
+                return -ERESTARTSYS;
+            dev->persist = !!arg;
+            up(&dev->sem);
+            break;
+
+        case SCULL_P_IOCQPERSIST:
+            return READ_ONCE(dev->persist);
+
+        case SCULL_P_IOCDROP:
+            if(down_interruptible(&dev->sem))
+                return -ERESTARTSYS;
+            // SPSC 모드나 mmap된 동안에는 세마포어 밖에서 rp가 바뀌므로 -EBUSY
+            if(dev->spsc || dev->fanout || dev->mq || scull_p_mapped(dev)){
+                retval = -EBUSY;
+            }else{
+                dev->rp = dev->wp = 0;
+                dev->lost = 0;
+                dev->drop = 1;
+                scull_p_ts_reset(dev);
+            }
+            up(&dev->sem);
+            if(!retval)
+                wake_up_interruptible_all(&dev->outq);
+            break;
+
+        case SCULL_P_IOCTSIZE:
+            return scull_p_resize(dev, arg);
+
+        case SCULL_P_IOCQSIZE:
+            return dev->buffer ? dev->buffersize :
+                   (dev->ringsize ? dev->ringsize : scull_p_buffer);
+
+        case SCULL_P_IOCTFULL:
+            WRITE_ONCE(dev->fullwrite, !!arg);
+            break;
+
+        case SCULL_P_IOCQFULL:
+            return READ_ONCE(dev->fullwrite);
+
+        case SCULL_P_IOCTSPSC:
+            if(down_interruptible(&dev->sem))
+                return -ERESTARTSYS;
+            if(arg && (dev->nreaders > 1 || dev->nwriters > 1 || dev->fanout || dev->mq ||
+                       dev->overwrite || dev->stamps || scull_p_mapped(dev)))
+                retval = -EBUSY;
+            else
+                WRITE_ONCE(dev->spsc, !!arg);
+            up(&dev->sem);
+            break;
+
+        case SCULL_P_IOCQSPSC:
+            return READ_ONCE(dev->spsc);
+
+        default:
+            return -ENOTTY;
+    }
+    return retval;
+}
+
+/*
+* /proc/scullpipe
+* 장치마다 CPU별 통계를 합산하여 출력, SCULL_P_IOCRSTATS로 초기화
+*/
+static void *scull_p_seq_start(struct seq_file *s, loff_t *pos)
+{
+    if(*pos >= scull_p_nr_devs)
+        return NULL;
+    return scull_p_devices + *pos;
+}
+
+static void *scull_p_seq_next(struct seq_file *s, void *v, loff_t *pos)
+{
+    (*pos)++;
+    if(*pos >= scull_p_nr_devs)
+        return NULL;
+    return scull_p_devices + *pos;
+}
+
+static void scull_p_seq_stop(struct seq_file *s, void *v) {}
+
+/* 0이 아닌 구간만 [하한, 상한) 개수 형태로 출력 */
+static void scull_p_seq_hist(struct seq_file *s, const char *name, const u64 *hist)
+{
+    int i;
+
+    seq_printf(s, "  %s:\n", name);
+    for(i = 0; i < SCULL_P_HIST; i++){
+        if(!hist[i])
+            continue;
+        if(!i)
+            seq_printf(s, "    %10u %10s %llu\n", 0, "", hist[i]);
+        else if(i == SCULL_P_HIST - 1)
+            seq_printf(s, "    %10llu %10s %llu\n", 1ULL << (i - 1), "~", hist[i]);
+        else
+            seq_printf(s, "    %10llu %10llu %llu\n", 1ULL << (i - 1), (1ULL << i) - 1, hist[i]);
+    }
+}
+
+static int scull_p_seq_show(struct seq_file *s, void *v)
+{
+    struct scull_pipe *dev = v;
+    struct scull_p_stats *sum;
+    u64 *dst, *src;
+    int cpu, dir, i;
+
+    sum = kzalloc(sizeof(*sum), GFP_KERNEL);
+    if(!sum)
+        return -ENOMEM;
+    for_each_possible_cpu(cpu){
+        src = (u64 *)per_cpu_ptr(dev->stats, cpu);
+        dst = (u64 *)sum;
+        for(i = 0; i < sizeof(*sum) / sizeof(u64); i++)
+            dst[i] += src[i];
+    }
+
+    seq_printf(s, "\nDevice %i: size %i, used %u, readers %i, writers %i\n",
+               scull_p_index(dev), dev->buffersize, dev->buffer ? scull_p_avail(dev) : 0,
+               dev->nreaders, dev->nwriters);
+    for(dir = SCULL_P_RD; dir <= SCULL_P_WR; dir++)
+        seq_printf(s, "  %-5s bytes %llu, ops %llu, sleeps %llu (%llu us), wakeups %llu, eagain %llu\n",
+                   dir == SCULL_P_RD ? "read" : "write", sum->bytes[dir], sum->ops[dir],
+                   sum->sleeps[dir], sum->wait_us[dir], sum->wakeups[dir], sum->eagain[dir]);
+    scull_p_seq_hist(s, "reader wait (us)", sum->wait_hist[SCULL_P_RD]);
+    scull_p_seq_hist(s, "writer wait (us)", sum->wait_hist[SCULL_P_WR]);
+    scull_p_seq_hist(s, "fill at write (bytes)", sum->fill_hist);
+    scull_p_seq_hist(s, "queueing delay (us)", sum->delay_hist);
+
+    kfree(sum);
+    return 0;
+}
+
+static const struct seq_operations scull_p_seq_ops = {
+    .start = scull_p_seq_start,
+    .next  = scull_p_seq_next,
+    .stop  = scull_p_seq_stop,
+    .show  = scull_p_seq_show
+};
+
+static int scull_p_proc_open(struct inode *inode, struct file *file)
+{
+    return seq_open(file, &scull_p_seq_ops);
+}
+
+static const struct proc_ops scull_p_proc_ops = {
+    .proc_open  = scull_p_proc_open,
+    .proc_read  = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = seq_release
+};
+
 /* file_operations */
 static const struct file_operations scull_p_fops = {
     .owner = THIS_MODULE,
-    .read = scull_p_read,
-    .write = scull_p_write,
+    .read_iter = scull_p_read_iter,
+    .write_iter = scull_p_write_iter,
+    .splice_read = copy_splice_read,
+    .splice_write = iter_file_splice_write,
     .poll = scull_p_poll,
+    .mmap = scull_p_mmap,
+    .unlocked_ioctl = scull_p_ioctl,
     .fasync = scull_p_fasync,
     .open = scull_p_open,
     .release = scull_p_release,
@@ -368,22 +2425,87 @@ static int __init scull_p_init(void)
         return -ENOMEM;
     }
 
+    // 3. 장치별 CPU별 통계와 multi-queue 모드의 percpu rwsem
+    for(i = 0; i < scull_p_nr_devs; i++){
+        scull_p_devices[i].stats = alloc_percpu(struct scull_p_stats);
+        if(scull_p_devices[i].stats && percpu_init_rwsem(&scull_p_devices[i].mq_sem)){
+            free_percpu(scull_p_devices[i].stats);
+            scull_p_devices[i].stats = NULL;
+        }
+        if(!scull_p_devices[i].stats){
+            while(i--){
+                percpu_free_rwsem(&scull_p_devices[i].mq_sem);
+                free_percpu(scull_p_devices[i].stats);
+            }
+            kfree(scull_p_devices);
+            unregister_chrdev_region(scull_p_devno, scull_p_nr_devs);
+            return -ENOMEM;
+        }
+    }
+
     /*
-    * 3. device 수만큼 초기화
+    * 4. device 수만큼 초기화
     *   ├ 세마포어
     *   ├ wait_queue
     *   └ cdev
     */
     for(i = 0; i < scull_p_nr_devs; i++){
+        scull_p_devices[i].spsc = !!scull_p_spsc;
+        scull_p_devices[i].fullwrite = !!scull_p_fullwrite;
+        scull_p_devices[i].persist = !!scull_p_persist;
+        scull_p_devices[i].packet = !!scull_p_packet;
         sema_init(&scull_p_devices[i].sem, 1);
+        atomic_set(&scull_p_devices[i].vmas, 0);
+        spin_lock_init(&scull_p_devices[i].ring_lock);
+        INIT_LIST_HEAD(&scull_p_devices[i].readers);
+        // fan-out 모드는 SPSC, record 모드와 함께 쓸 수 없음
+        if(!scull_p_spsc && !scull_p_packet)
+            scull_p_devices[i].fanout = clamp(scull_p_fanout, SCULL_P_FANOUT_OFF, SCULL_P_FANOUT_LOSSY);
+        // overwrite 모드는 SPSC, fan-out 모드와 함께 쓸 수 없음
+        if(!scull_p_devices[i].spsc && !scull_p_devices[i].fanout)
+            scull_p_devices[i].overwrite = !!scull_p_overwrite;
+        // timestamp 모드는 SPSC, fan-out 모드와 함께 쓸 수 없음, 할당에 실패하면 꺼진 채로 둠
+        if(scull_p_tstamp && !scull_p_devices[i].spsc && !scull_p_devices[i].fanout)
+            scull_p_devices[i].stamps = kmalloc_array(SCULL_P_TS_MAX, sizeof(struct scull_p_stamp),
+                                                      GFP_KERNEL);
+        scull_p_devices[i].rcvlowat = max(scull_p_rcvlowat, 1);
+        scull_p_devices[i].sndlowat = max(scull_p_sndlowat, 1);
+        scull_p_devices[i].rcvtimeo = msecs_to_jiffies(max(scull_p_rcvtimeo, 0));
+        INIT_LIST_HEAD(&scull_p_devices[i].async_files);
+        spin_lock_init(&scull_p_devices[i].sig_lock);
+        scull_p_devices[i].sigflags = scull_p_sigio &
+            (SCULL_P_SIGIO_EDGE | SCULL_P_SIGIO_OUT | SCULL_P_SIGIO_ONE);
+        scull_p_devices[i].sig_interval = msecs_to_jiffies(max(scull_p_sigio_ms, 0));
+        scull_p_devices[i].sig_next = jiffies;
+        scull_p_devices[i].sig_armed = BIT(SCULL_P_SIG_IN) | BIT(SCULL_P_SIG_OUT);
+        timer_setup(&scull_p_devices[i].sig_timer, scull_p_sig_timer, 0);
         init_waitqueue_head(&scull_p_devices[i].inq);
         init_waitqueue_head(&scull_p_devices[i].outq);
 
+        // persist 모드면 첫 open을 기다리지 않고 미리 할당, 실패해도 open에서 다시 시도
+        if(scull_p_devices[i].persist)
+            scull_p_alloc_buffer(&scull_p_devices[i]);
+
         cdev_init(&scull_p_devices[i].cdev, &scull_p_fops);
         scull_p_devices[i].cdev.owner = THIS_MODULE;
         cdev_add(&scull_p_devices[i].cdev, scull_p_devno + i, 1);
     }
 
+    // 5. 통계를 보여줄 proc 파일
+    proc_create("scullpipe", 0, NULL, &scull_p_proc_ops);
+
+    /*
+    * 6. persist 모드 버퍼 회수를 위한 shrinker 등록
+    * 등록에 실패해도 동작에는 문제가 없으므로 경고만 출력
+    */
+    scull_p_shrinker = shrinker_alloc(0, "scullpipe");
+    if(scull_p_shrinker){
+        scull_p_shrinker->count_objects = scull_p_shrink_count;
+        scull_p_shrinker->scan_objects = scull_p_shrink_scan;
+        shrinker_register(scull_p_shrinker);
+    }else
+        printk(KERN_WARNING "scullpipe: can't register shrinker\n");
+
     printk(KERN_INFO "scullpipe: loaded major = %d\n", MAJOR(scull_p_devno));
     return 0;
 }
@@ -391,6 +2513,11 @@ static int __init scull_p_init(void)
 static void __exit scull_p_exit(void)
 {
     int i;
+
+    // shrinker가 장치에 접근하지 않도록 가장 먼저 해제
+    shrinker_free(scull_p_shrinker);
+    remove_proc_entry("scullpipe", NULL);
+
     /*
     * 1. device 수만큼 할당 해제
     *   ├ cdev 제거
@@ -398,7 +2525,13 @@ static void __exit scull_p_exit(void)
     */
     for(i = 0; i < scull_p_nr_devs; i++){
         cdev_del(&scull_p_devices[i].cdev);
-        kfree(scull_p_devices[i].buffer);
+        timer_delete_sync(&scull_p_devices[i].sig_timer);
+        kvfree(scull_p_devices[i].buffer);
+        free_page((unsigned long)scull_p_devices[i].ring);
+        scull_p_mq_free(scull_p_devices[i].queues, scull_p_devices[i].nqueues);
+        percpu_free_rwsem(&scull_p_devices[i].mq_sem);
+        free_percpu(scull_p_devices[i].stats);
+        kfree(scull_p_devices[i].stamps);
     }
 
     // 2. 장치 집합 할당 해제
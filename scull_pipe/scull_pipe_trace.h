@@ -0,0 +1,103 @@
+/*
+ * scull_pipe tracepoint
+ * 꺼져 있을 때는 static key로 건너뛰므로 data path 비용이 거의 없음
+ * echo 1 > /sys/kernel/tracing/events/scull_pipe/enable 또는 perf trace -e 'scull_pipe:*'로 사용
+ *
+ * dev: 장치 번호 (scullpipeN), used: 이벤트 시점에 ring에 쌓여 있는 바이트 수
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM scull_pipe
+
+#if !defined(_SCULL_PIPE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SCULL_PIPE_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* 데이터 전송: bytes만큼 읽거나 쓴 뒤 */
+DECLARE_EVENT_CLASS(scull_p_xfer,
+
+    TP_PROTO(int dev, size_t bytes, unsigned int used, unsigned int size),
+
+    TP_ARGS(dev, bytes, used, size),
+
+    TP_STRUCT__entry(
+        __field(int,            dev)
+        __field(size_t,         bytes)
+        __field(unsigned int,   used)
+        __field(unsigned int,   size)
+    ),
+
+    TP_fast_assign(
+        __entry->dev = dev;
+        __entry->bytes = bytes;
+        __entry->used = used;
+        __entry->size = size;
+    ),
+
+    TP_printk("dev=%d bytes=%zu used=%u/%u",
+              __entry->dev, __entry->bytes, __entry->used, __entry->size)
+);
+
+/* write가 wp 위치에 bytes만큼 복사하기 직전 */
+DEFINE_EVENT(scull_p_xfer, scull_p_accept,
+    TP_PROTO(int dev, size_t bytes, unsigned int used, unsigned int size),
+    TP_ARGS(dev, bytes, used, size)
+);
+
+DEFINE_EVENT(scull_p_xfer, scull_p_read,
+    TP_PROTO(int dev, size_t bytes, unsigned int used, unsigned int size),
+    TP_ARGS(dev, bytes, used, size)
+);
+
+DEFINE_EVENT(scull_p_xfer, scull_p_write,
+    TP_PROTO(int dev, size_t bytes, unsigned int used, unsigned int size),
+    TP_ARGS(dev, bytes, used, size)
+);
+
+/*
+ * 대기: sleep은 reader(writer)가 bytes만큼 쌓이기(비기)를 기다리며 잠들 때
+ * wake는 bytes만큼 쌓여(비어) 대기 중인 reader(writer)를 깨울 때
+ */
+DECLARE_EVENT_CLASS(scull_p_wait,
+
+    TP_PROTO(int dev, bool write, size_t bytes, unsigned int used),
+
+    TP_ARGS(dev, write, bytes, used),
+
+    TP_STRUCT__entry(
+        __field(int,            dev)
+        __field(bool,           write)
+        __field(size_t,         bytes)
+        __field(unsigned int,   used)
+    ),
+
+    TP_fast_assign(
+        __entry->dev = dev;
+        __entry->write = write;
+        __entry->bytes = bytes;
+        __entry->used = used;
+    ),
+
+    TP_printk("dev=%d %s bytes=%zu used=%u",
+              __entry->dev, __entry->write ? "writer" : "reader",
+              __entry->bytes, __entry->used)
+);
+
+DEFINE_EVENT(scull_p_wait, scull_p_sleep,
+    TP_PROTO(int dev, bool write, size_t bytes, unsigned int used),
+    TP_ARGS(dev, write, bytes, used)
+);
+
+DEFINE_EVENT(scull_p_wait, scull_p_wake,
+    TP_PROTO(int dev, bool write, size_t bytes, unsigned int used),
+    TP_ARGS(dev, write, bytes, used)
+);
+
+#endif /* _SCULL_PIPE_TRACE_H */
+
+/* 이 부분은 header guard 밖에 있어야 함 */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE scull_pipe_trace
+#include <trace/define_trace.h>
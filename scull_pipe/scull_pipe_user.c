@@ -3,20 +3,30 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sys/ioctl.h>
+
+#include "scull_pipe_user.h"
+
+/*
+ * 사용법: ./scull_pipe_user [interval ms]
+ * 인자를 주면 edge 모드로 바꾸고 SIGIO 사이 간격을 interval ms로 제한
+ * edge 모드에서는 SIGIO 하나에 여러 write가 모여 있을 수 있으므로 -EAGAIN까지 읽음
+ */
 
 int fd;
 
 void sigio_handler(int sig)
 {
     char buf[128];
-    int n = read(fd, buf, sizeof(buf)-1);
-    if (n > 0) {
+    int n;
+
+    while ((n = read(fd, buf, sizeof(buf)-1)) > 0) {
         buf[n] = '\0';
         printf("SIGIO: read %d bytes: %s\n", n, buf);
     }
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     fd = open("/dev/scullpipe0", O_RDONLY | O_NONBLOCK);
     if (fd < 0) {
@@ -24,20 +34,36 @@ int main()
         exit(1);
     }
 
+    /* SIGIO 전송 방식 변경 */
+    if (argc > 1) {
+        struct scull_p_sigio sg = {
+            .flags = SCULL_P_SIGIO_EDGE,
+            .interval_ms = atoi(argv[1]),
+        };
+
+        if (ioctl(fd, SCULL_P_IOCSSIGIO, &sg) < 0) {
+            perror("ioctl SCULL_P_IOCSSIGIO");
+            exit(1);
+        }
+    }
+
     /* SIGIO 받을 owner 등록 */
     if (fcntl(fd, F_SETOWN, getpid()) < 0) {
         perror("fcntl F_SETOWN");
         exit(1);
     }
 
+    /* SIGIO 핸들러 등록 */
+    signal(SIGIO, sigio_handler);
+
     /* 파일을 O_ASYNC 모드로 바꿔 SIGIO 받게 */
     if (fcntl(fd, F_SETFL, O_ASYNC | O_NONBLOCK) < 0) {
         perror("fcntl F_SETFL");
         exit(1);
     }
 
-    /* SIGIO 핸들러 등록 */
-    signal(SIGIO, sigio_handler);
+    /* 등록 전에 쓰인 데이터 */
+    sigio_handler(SIGIO);
 
     printf("Waiting for SIGIO on /dev/scullpipe0 ...\n");
     while (1) {
@@ -0,0 +1,135 @@
+#ifndef _SCULL_PIPE_USER_H_
+#define _SCULL_PIPE_USER_H_
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* scull.h의 scull_pipe ioctl 정의와 동일하게 유지 */
+#define SCULL_IOC_MAGIC 'k'
+
+/* SCULL_P_IOCRECVMMSG 인자, recvmmsg의 mmsghdr와 같은 역할 */
+struct scull_p_msg {
+    __u64 buf;          /* 사용자 버퍼 주소 */
+    __u32 len;          /* 버퍼 크기 */
+    __u32 msg_len;      /* 복사된 바이트 수 (반환) */
+    __u32 rec_len;      /* 원래 record 크기, msg_len보다 크면 잘린 것 (반환) */
+    __u32 reserved;
+};
+
+struct scull_p_mmsg {
+    __u64 msgs;         /* struct scull_p_msg 배열 주소 */
+    __u32 vlen;         /* 배열 크기 */
+    __u32 reserved;
+};
+
+/*
+ * mmap ring의 control page, 파일 offset 0에 매핑되고 ring 데이터는 그 다음 페이지부터 size 바이트
+ * producer는 데이터를 쓴 뒤 head를, consumer는 읽은 뒤 tail을 release store로 공개
+ * head == tail이면 비어 있고, 한 바이트는 항상 비워둠
+ * head와 tail은 서로 다른 cache line에 둠
+ */
+struct scull_p_ring_ctrl {
+    __u32 head;             /* producer가 다음에 쓸 위치 */
+    __u32 pad0[15];
+    __u32 tail;             /* consumer가 다음에 읽을 위치 */
+    __u32 pad1[15];
+    __u32 size;             /* ring 데이터 크기 */
+};
+
+/* SCULL_P_IOCRINGWAKE 인자 */
+#define SCULL_P_RING_IN   1 /* 비어 있던 ring에 데이터를 넣음 -> reader를 깨움 */
+#define SCULL_P_RING_OUT  2 /* 가득 찼던 ring을 비움 -> writer를 깨움 */
+
+/* SCULL_P_IOCTFANOUT 인자 */
+#define SCULL_P_FANOUT_OFF    0 /* reader들이 하나의 rp를 나눠 읽음 */
+#define SCULL_P_FANOUT_BLOCK  1 /* reader마다 모든 데이터를 읽음, 가장 느린 reader를 writer가 기다림 */
+#define SCULL_P_FANOUT_LOSSY  2 /* writer는 기다리지 않음, 뒤처진 reader는 -EOVERFLOW 후 건너뜀 */
+
+/*
+ * SCULL_P_IOCSWMARK / SCULL_P_IOCGWMARK 인자
+ * reader는 rcvlowat 바이트가 쌓이거나 rcvtimeo_ms가 지나야 깨어나고 (timeout 시 있는 만큼 반환)
+ * writer는 sndlowat 바이트가 비어야 깨어남, poll의 POLLIN / POLLOUT도 같은 기준
+ */
+struct scull_p_wmark {
+    __u32 rcvlowat;         /* 1 이상, 버퍼 크기 - 1로 제한됨 */
+    __u32 sndlowat;         /* 1 이상, 버퍼 크기 - 1로 제한됨 */
+    __u32 rcvtimeo_ms;      /* 0이면 무한 */
+    __u32 reserved;
+};
+
+/*
+ * SCULL_P_IOCGOVERRUN 결과
+ * overwrite 모드에서 버린 데이터는 다음 read(recvmmsg)가 -EOVERFLOW로 한 번 알리고
+ * 그 구간에서 버린 양은 lost로 확인
+ */
+struct scull_p_overrun {
+    __u64 overrun;          /* 지금까지 버린 바이트 수 (record 모드는 header 포함) */
+    __u64 lost;             /* 마지막 -EOVERFLOW 구간에서 버린 바이트 수 */
+    __u64 pending;          /* 아직 -EOVERFLOW로 알리지 않은 버린 바이트 수 */
+    __u64 gaps;             /* -EOVERFLOW로 알린 횟수 */
+};
+
+/*
+ * SCULL_P_IOCSSIGIO / SCULL_P_IOCGSIGIO 인자
+ * flags가 0이고 interval_ms가 0이면 write마다 모든 reader에게 POLL_IN 전송
+ */
+struct scull_p_sigio {
+    __u32 flags;            /* SCULL_P_SIGIO_* */
+    __u32 interval_ms;      /* SIGIO 사이 최소 간격, 그 안의 SIGIO는 모아서 간격이 지난 뒤 한 번 전송 */
+};
+
+#define SCULL_P_SIGIO_EDGE  0x1 /* 비어 있다가 데이터가 생길 때(가득 찼다가 공간이 생길 때)만 전송 */
+#define SCULL_P_SIGIO_OUT   0x2 /* read로 공간이 생기면 writer에게 POLL_OUT 전송 */
+#define SCULL_P_SIGIO_ONE   0x4 /* 등록한 파일 중 하나에만 돌아가며 전송 */
+
+/*
+ * SCULL_P_IOCGTSTAMP 결과
+ * timestamp 모드에서 이 파일의 마지막 read(record)가 읽은 데이터의 적재 시각 (CLOCK_MONOTONIC, ns)
+ * read_ns - first_ns가 가장 오래 머문 바이트의 queueing delay
+ */
+struct scull_p_tstamp {
+    __u64 first_ns;         /* 읽은 데이터 중 가장 먼저 쓰인 구간의 적재 시각 */
+    __u64 last_ns;          /* 가장 나중에 쓰인 구간의 적재 시각 */
+    __u64 read_ns;          /* read 시각 */
+    __u32 segments;         /* 걸친 write 구간 수, 0이면 적재 시각 없음 */
+    __u32 reserved;
+};
+
+/* SCULL_P_IOCTMQ 인자 */
+#define SCULL_P_MQ_OFF       0 /* 장치의 ring 하나 사용 */
+#define SCULL_P_MQ_CPU       1 /* writer는 현재 CPU의 sub-ring에 씀, 순서는 sub-ring 안에서만 보장 */
+#define SCULL_P_MQ_PRODUCER  2 /* writer(open)마다 sub-ring 하나를 고정, producer별 FIFO 보장 */
+
+/* scull_pipe 버퍼 크기 (T: 변경, Q: 조회) */
+#define SCULL_P_IOCTSIZE  _IO(SCULL_IOC_MAGIC, 13)
+#define SCULL_P_IOCQSIZE  _IO(SCULL_IOC_MAGIC, 14)
+
+/* scull_pipe 전용 ioctl, 20번부터 사용 */
+#define SCULL_P_IOCTSPSC  _IO(SCULL_IOC_MAGIC, 20)  /* SPSC 모드 설정 (0 / 1) */
+#define SCULL_P_IOCQSPSC  _IO(SCULL_IOC_MAGIC, 21)  /* SPSC 모드 조회 */
+#define SCULL_P_IOCTFULL  _IO(SCULL_IOC_MAGIC, 22)  /* full write 모드 설정 (0 / 1) */
+#define SCULL_P_IOCQFULL  _IO(SCULL_IOC_MAGIC, 23)  /* full write 모드 조회 */
+#define SCULL_P_IOCTPERSIST _IO(SCULL_IOC_MAGIC, 24)  /* persist 모드 설정 (0 / 1) */
+#define SCULL_P_IOCQPERSIST _IO(SCULL_IOC_MAGIC, 25)  /* persist 모드 조회 */
+#define SCULL_P_IOCDROP     _IO(SCULL_IOC_MAGIC, 26)  /* 데이터 버림, 마지막 close 때 버퍼 해제 */
+#define SCULL_P_IOCTPACKET  _IO(SCULL_IOC_MAGIC, 27)  /* record 모드 설정 (0 / 1) */
+#define SCULL_P_IOCQPACKET  _IO(SCULL_IOC_MAGIC, 28)  /* record 모드 조회 */
+#define SCULL_P_IOCRECVMMSG _IOWR(SCULL_IOC_MAGIC, 29, struct scull_p_mmsg) /* record batch read */
+#define SCULL_P_IOCRINGWAKE _IO(SCULL_IOC_MAGIC, 30)  /* mmap ring 상태 전이 알림 */
+#define SCULL_P_IOCTFANOUT  _IO(SCULL_IOC_MAGIC, 31)  /* fan-out 모드 설정 (SCULL_P_FANOUT_*) */
+#define SCULL_P_IOCQFANOUT  _IO(SCULL_IOC_MAGIC, 32)  /* fan-out 모드 조회 */
+#define SCULL_P_IOCTMQ      _IO(SCULL_IOC_MAGIC, 33)  /* multi-queue 모드 설정 (SCULL_P_MQ_*) */
+#define SCULL_P_IOCQMQ      _IO(SCULL_IOC_MAGIC, 34)  /* multi-queue 모드 조회 */
+#define SCULL_P_IOCSWMARK   _IOW(SCULL_IOC_MAGIC, 35, struct scull_p_wmark) /* watermark 설정 */
+#define SCULL_P_IOCGWMARK   _IOR(SCULL_IOC_MAGIC, 36, struct scull_p_wmark) /* watermark 조회 */
+#define SCULL_P_IOCTOVERWRITE _IO(SCULL_IOC_MAGIC, 37) /* overwrite 모드 설정 (0 / 1) */
+#define SCULL_P_IOCQOVERWRITE _IO(SCULL_IOC_MAGIC, 38) /* overwrite 모드 조회 */
+#define SCULL_P_IOCGOVERRUN _IOR(SCULL_IOC_MAGIC, 39, struct scull_p_overrun) /* 버린 데이터 통계 */
+#define SCULL_P_IOCSSIGIO   _IOW(SCULL_IOC_MAGIC, 40, struct scull_p_sigio) /* SIGIO 전송 방식 설정 */
+#define SCULL_P_IOCGSIGIO   _IOR(SCULL_IOC_MAGIC, 41, struct scull_p_sigio) /* SIGIO 전송 방식 조회 */
+#define SCULL_P_IOCRSTATS   _IO(SCULL_IOC_MAGIC, 42)  /* /proc/scullpipe 통계 초기화 */
+#define SCULL_P_IOCTTSTAMP  _IO(SCULL_IOC_MAGIC, 43)  /* timestamp 모드 설정 (0 / 1) */
+#define SCULL_P_IOCQTSTAMP  _IO(SCULL_IOC_MAGIC, 44)  /* timestamp 모드 조회 */
+#define SCULL_P_IOCGTSTAMP  _IOR(SCULL_IOC_MAGIC, 45, struct scull_p_tstamp) /* 마지막 read의 적재 시각 */
+
+#endif